@@ -0,0 +1,73 @@
+#include <TMC5160.h>
+
+// Compares the table driven UART CRC8 used by the library with the former bit-serial loop,
+// on 4-byte read requests and 8-byte write / reply datagrams.
+// On the host build (extras/host), micros() is virtual time : run it with HOST_REAL_TIME=1
+// (make crc-bench) for meaningful timings.
+
+const long SERIAL_BAUD_RATE = 115200;
+const uint16_t ITERATIONS = 10000;
+
+// Former implementation : 8 shifts per byte
+uint8_t bitwiseCrc(const uint8_t *datagram, uint8_t length)
+{
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < length; i++)
+  {
+    uint8_t currentByte = datagram[i];
+    for (uint8_t j = 0; j < 8; j++)
+    {
+      if ((crc >> 7) ^ (currentByte & 0x01))
+        crc = (crc << 1) ^ 0x07;
+      else
+        crc = (crc << 1);
+
+      currentByte = currentByte >> 1;
+    }
+  }
+  return crc;
+}
+
+volatile uint8_t sink; // Keeps the compiler from dropping the loops
+
+void benchmark(const char *name, const uint8_t *datagram, uint8_t length)
+{
+  if (bitwiseCrc(datagram, length) != TMC5160_UART_Generic::crc8(datagram, length))
+  {
+    Serial.print(name);
+    Serial.println(": CRC mismatch !");
+    return;
+  }
+
+  unsigned long start = micros();
+  for (uint16_t i = 0; i < ITERATIONS; i++)
+    sink = bitwiseCrc(datagram, length);
+  unsigned long bitwiseTime = micros() - start;
+
+  start = micros();
+  for (uint16_t i = 0; i < ITERATIONS; i++)
+    sink = TMC5160_UART_Generic::crc8(datagram, length);
+  unsigned long tableTime = micros() - start;
+
+  Serial.print(name);
+  Serial.print(": bitwise ");
+  Serial.print((float)bitwiseTime * 1000.0 / ITERATIONS);
+  Serial.print(" ns, table ");
+  Serial.print((float)tableTime * 1000.0 / ITERATIONS);
+  Serial.println(" ns per datagram");
+}
+
+void setup()
+{
+  Serial.begin(SERIAL_BAUD_RATE);
+
+  const uint8_t readRequest[3] = { 0x05, 0x00, 0x21 };
+  const uint8_t writeDatagram[7] = { 0x05, 0x00, 0xA7, 0x00, 0x01, 0x86, 0xA0 };
+
+  benchmark("read request", readRequest, sizeof(readRequest));
+  benchmark("write datagram", writeDatagram, sizeof(writeDatagram));
+}
+
+void loop()
+{
+}
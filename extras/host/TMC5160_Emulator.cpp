@@ -0,0 +1,845 @@
+#include "TMC5160_Emulator.h"
+
+TMC5160_Emulator::TMC5160_Emulator(uint8_t chipSelectPin, uint32_t fclk)
+: _output(0), _fclk(fclk), _clock(0), _velocity(0), _positionFraction(0), _zeroWait(0), _braking(false),
+  _chipSelectPin(chipSelectPin), _spi(nullptr), _selected(false), _spiShift(0), _spiBytes(0),
+  _spiReadData(0), _spiDatagrams(0), _nai(false), _uartLength(0), _uartLastByteMicros(0), _corruptReplies(0),
+  _dropDatagrams(0), _dropAfter(0), _uartDatagrams(0)
+{
+    _diagPins[0] = _diagPins[1] = NO_PIN;
+    _diagLevels[0] = _diagLevels[1] = -1;
+    powerOn();
+}
+
+TMC5160_Emulator::~TMC5160_Emulator()
+{
+    if (_spi != nullptr) {
+        _spi->detach(*this);
+        hostRemovePinHandler(_chipSelectPin, _onChipSelect, this);
+    }
+}
+
+void TMC5160_Emulator::attach(SPIClass &spi)
+{
+    if (_spi != nullptr || _chipSelectPin == NO_PIN)
+        return;
+
+    _spi = &spi;
+    _spi->attach(*this);
+    hostAddPinHandler(_chipSelectPin, _onChipSelect, this);
+}
+
+void TMC5160_Emulator::powerOn()
+{
+    memset(_registers, 0, sizeof(_registers));
+    _output = 0;
+
+    GSTAT_Register gstat = { 0 };
+    gstat.reset = true;
+    _registers[ADDRESS_GSTAT] = gstat.bytes;
+
+    _registers[ADDRESS_IO_INPUT_OUTPUT] = (uint32_t)IC_VERSION << 24;
+    _registers[ADDRESS_CHOPCONF] = 0x10410150;
+    _registers[ADDRESS_PWMCONF] = 0xC40C001E;
+    _registers[ADDRESS_ENC_CONST] = 0x00010000;
+    _registers[ADDRESS_MSLUTSEL] = 0xFFFF8056;
+    _registers[ADDRESS_MSLUTSTART] = 0x00F70000;
+
+    // event_pos_reached is also set by a reset (datasheet §16)
+    RAMP_STAT_Register rampStat = { 0 };
+    rampStat.event_pos_reached = true;
+    _registers[ADDRESS_RAMP_STAT] = rampStat.bytes;
+
+    _spiShift = 0;
+    _spiBytes = 0;
+    _spiReadData = 0;
+    _uartLength = 0;
+
+    _clock = _clocksAt(hostMicros());
+    _velocity = 0;
+    _positionFraction = 0;
+    _zeroWait = 0;
+    _braking = false;
+
+    _updateStatus();
+}
+
+uint32_t TMC5160_Emulator::peekRegister(uint8_t address)
+{
+    update();
+    address &= 0x7F;
+    return address < REGISTER_ADDRESS_COUNT ? _registers[address] : 0;
+}
+
+void TMC5160_Emulator::pokeRegister(uint8_t address, uint32_t value)
+{
+    address &= 0x7F;
+    if (address >= REGISTER_ADDRESS_COUNT)
+        return;
+
+    update();
+    _registers[address] = value;
+
+    if (address == ADDRESS_VACTUAL)
+        _velocity = (int64_t)((int32_t)(value << 8) >> 8) * (1LL << VELOCITY_SHIFT);
+    else if (address == ADDRESS_XACTUAL)
+        _positionFraction = 0;
+
+    _updateStatus();
+}
+
+uint8_t TMC5160_Emulator::getUartAddress() const
+{
+    SLAVECONF_Register slaveConf;
+    slaveConf.bytes = _registers[ADDRESS_SLAVECONF];
+    return slaveConf.slaveaddr + (_nai ? 1 : 0);
+}
+
+void TMC5160_Emulator::setDiagPins(uint8_t diag0Pin, uint8_t diag1Pin)
+{
+    _diagPins[0] = diag0Pin;
+    _diagPins[1] = diag1Pin;
+    _diagLevels[0] = _diagLevels[1] = -1;
+    _updateDiagOutputs();
+}
+
+SPI_STATUS_Register TMC5160_Emulator::getSpiStatus() const
+{
+    GSTAT_Register gstat = { 0 };
+    DRV_STATUS_Register drvStatus = { 0 };
+    RAMP_STAT_Register rampStat = { 0 };
+    gstat.bytes = _registers[ADDRESS_GSTAT];
+    drvStatus.bytes = _registers[ADDRESS_DRV_STATUS];
+    rampStat.bytes = _registers[ADDRESS_RAMP_STAT];
+
+    SPI_STATUS_Register status = { 0 };
+    status.reset_flag = gstat.reset;
+    status.driver_error = gstat.drv_err;
+    status.sg2 = drvStatus.stallguard;
+    status.standstill = drvStatus.stst;
+    status.velocity_reached = rampStat.velocity_reached;
+    status.position_reached = rampStat.position_reached;
+    status.status_stop_l = rampStat.status_stop_l;
+    status.status_stop_r = rampStat.status_stop_r;
+    return status;
+}
+
+/* Register accesses */
+
+// Datasheet register map, kept apart from TMC5160::getRegisterAccess() so the host build checks it
+uint8_t TMC5160_Emulator::_access(uint8_t address)
+{
+    switch (address) {
+    case 0x00: return REG_READ | REG_WRITE;              // GCONF
+    case 0x01: return REG_READ | REG_WRITE | REG_CLEAR;  // GSTAT
+    case 0x02: return REG_READ;                          // IFCNT
+    case 0x03: return REG_WRITE;                         // SLAVECONF
+    case 0x04: return REG_READ | REG_WRITE;              // IOIN / OUTPUT
+    case 0x05: return REG_WRITE;                         // X_COMPARE
+    case 0x06: return REG_WRITE;                         // OTP_PROG
+    case 0x07: return REG_READ;                          // OTP_READ
+    case 0x08: return REG_READ | REG_WRITE;              // FACTORY_CONF
+    case 0x09: case 0x0A: case 0x0B: return REG_WRITE;   // SHORT_CONF, DRV_CONF, GLOBAL_SCALER
+    case 0x0C: return REG_READ;                          // OFFSET_READ
+
+    case 0x10: case 0x11: return REG_WRITE;              // IHOLD_IRUN, TPOWERDOWN
+    case 0x12: return REG_READ;                          // TSTEP
+    case 0x13: case 0x14: case 0x15: return REG_WRITE;   // TPWMTHRS, TCOOLTHRS, THIGH
+
+    case 0x20: case 0x21: return REG_READ | REG_WRITE;   // RAMPMODE, XACTUAL
+    case 0x22: return REG_READ;                          // VACTUAL
+    case 0x23: case 0x24: case 0x25: case 0x26: case 0x27: case 0x28:
+        return REG_WRITE;                                // VSTART, A1, V1, AMAX, VMAX, DMAX
+    case 0x2A: case 0x2B: case 0x2C: return REG_WRITE;   // D1, VSTOP, TZEROWAIT
+    case 0x2D: return REG_READ | REG_WRITE;              // XTARGET
+
+    case 0x33: return REG_WRITE;                         // VDCMIN
+    case 0x34: return REG_READ | REG_WRITE;              // SW_MODE
+    case 0x35: return REG_READ | REG_WRITE | REG_CLEAR;  // RAMP_STAT
+    case 0x36: return REG_READ;                          // XLATCH
+
+    case 0x38: case 0x39: return REG_READ | REG_WRITE;   // ENCMODE, X_ENC
+    case 0x3A: return REG_WRITE;                         // ENC_CONST
+    case 0x3B: return REG_READ | REG_WRITE | REG_CLEAR;  // ENC_STATUS
+    case 0x3C: return REG_READ;                          // ENC_LATCH
+    case 0x3D: return REG_WRITE;                         // ENC_DEVIATION
+
+    case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67:
+    case 0x68: case 0x69: return REG_WRITE;              // MSLUT[0..7], MSLUTSEL, MSLUTSTART
+    case 0x6A: case 0x6B: return REG_READ;               // MSCNT, MSCURACT
+    case 0x6C: return REG_READ | REG_WRITE;              // CHOPCONF
+    case 0x6D: case 0x6E: return REG_WRITE;              // COOLCONF, DCCTRL
+    case 0x6F: return REG_READ;                          // DRV_STATUS
+    case 0x70: return REG_WRITE;                         // PWMCONF
+    case 0x71: case 0x72: case 0x73: return REG_READ;    // PWM_SCALE, PWM_AUTO, LOST_STEPS
+
+    default: return 0;
+    }
+}
+
+// Datasheet UART CRC8 : polynomial x^8 + x^2 + x + 1, bits fed LSB first. Bit serial on purpose.
+uint8_t TMC5160_Emulator::_crc8(const uint8_t *data, uint8_t length)
+{
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = ((crc >> 7) ^ (byte & 0x01)) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+uint32_t TMC5160_Emulator::_read(uint8_t address)
+{
+    if (address >= REGISTER_ADDRESS_COUNT || !(_access(address) & REG_READ))
+        return 0;
+
+    return _registers[address];
+}
+
+void TMC5160_Emulator::_write(uint8_t address, uint32_t data)
+{
+    if (address >= REGISTER_ADDRESS_COUNT)
+        return;
+
+    switch (address) {
+    case ADDRESS_GSTAT:
+        _registers[address] &= ~(data & GSTAT_CLEAR_MASK);
+        break;
+    case ADDRESS_RAMP_STAT:
+        _registers[address] &= ~(data & RAMP_STAT_CLEAR_MASK);
+        break;
+    case ADDRESS_ENC_STATUS:
+        _registers[address] &= ~(data & ENC_STATUS_CLEAR_MASK);
+        break;
+    case ADDRESS_IO_INPUT_OUTPUT:
+        _output = data & 0x01;
+        break;
+    case ADDRESS_XACTUAL:
+        _registers[address] = data;
+        _positionFraction = 0;
+        _braking = false;
+        break;
+    case ADDRESS_RAMPMODE:
+    case ADDRESS_XTARGET:
+    case ADDRESS_VMAX:
+        _registers[address] = data;
+        _braking = false;  // New move : the ramp may accelerate again
+        break;
+    default:
+        if (_access(address) & REG_WRITE)
+            _registers[address] = data;
+        break;
+    }
+
+    _updateStatus();
+}
+
+// Flags derived from the register values
+void TMC5160_Emulator::_updateStatus()
+{
+    RAMP_STAT_Register rampStat;
+    DRV_STATUS_Register drvStatus;
+    rampStat.bytes = _registers[ADDRESS_RAMP_STAT];
+    drvStatus.bytes = _registers[ADDRESS_DRV_STATUS];
+
+    // VACTUAL is 24 bit two's complement, truncated towards zero
+    int32_t vActual = (int32_t)(_velocity / (1LL << VELOCITY_SHIFT));
+    _registers[ADDRESS_VACTUAL] = (uint32_t)vActual & 0xFFFFFF;
+
+    int32_t xActual = (int32_t)_registers[ADDRESS_XACTUAL];
+    int32_t xTarget = (int32_t)_registers[ADDRESS_XTARGET];
+    int32_t vMax = (int32_t)_rampRegister(ADDRESS_VMAX);
+    uint32_t rampMode = _registers[ADDRESS_RAMPMODE] & 0x03;
+
+    bool positionReached = rampMode == 0 && xActual == xTarget;
+    if (positionReached && !rampStat.position_reached)
+        rampStat.event_pos_reached = true;
+    rampStat.position_reached = positionReached;
+
+    switch (rampMode) {
+    case 1: rampStat.velocity_reached = vActual == vMax; break;
+    case 2: rampStat.velocity_reached = vActual == -vMax; break;
+    case 3: rampStat.velocity_reached = true; break;  // Hold mode keeps the current velocity
+    default: rampStat.velocity_reached = vActual == vMax || vActual == -vMax; break;
+    }
+
+    rampStat.vzero = vActual == 0;
+    rampStat.t_zerowait_active = _zeroWait > 0;
+    drvStatus.stst = vActual == 0;
+
+    _registers[ADDRESS_RAMP_STAT] = rampStat.bytes;
+    _registers[ADDRESS_DRV_STATUS] = drvStatus.bytes;
+
+    _updateDiagOutputs();
+}
+
+// Motion controller mode (SD_MODE=0) : DIAG0 is the interrupt output, GCONF bits 7 / 8 route the stall
+void TMC5160_Emulator::_updateDiagOutputs()
+{
+    GCONF_Register gconf;
+    GSTAT_Register gstat;
+    RAMP_STAT_Register rampStat;
+    gconf.bytes = _registers[ADDRESS_GCONF];
+    gstat.bytes = _registers[ADDRESS_GSTAT];
+    rampStat.bytes = _registers[ADDRESS_RAMP_STAT];
+
+    bool active[2];
+    active[0] = (rampStat.bytes & 0xF0) != 0  // event_stop_l, event_stop_r, event_stop_sg, event_pos_reached
+             || (_registers[ADDRESS_ENC_STATUS] & ENC_STATUS_CLEAR_MASK) != 0
+             || (gconf.diag0_error && (gstat.drv_err || gstat.uv_cp))
+             || (gconf.diag0_stall_step && rampStat.status_sg);
+    active[1] = gconf.diag1_stall_dir && rampStat.status_sg;
+
+    bool pushPull[2] = { gconf.diag0_int_pushpull != 0, gconf.diag1_poscomp_pushpull != 0 };
+
+    for (uint8_t line = 0; line < 2; line++) {
+        if (_diagPins[line] == NO_PIN)
+            continue;
+
+        int8_t level = active[line] == pushPull[line] ? HIGH : LOW;
+        if (level != _diagLevels[line]) {
+            _diagLevels[line] = level;
+            hostSetPinInput(_diagPins[line], level);
+        }
+    }
+}
+
+/* SPI */
+
+void TMC5160_Emulator::_onChipSelect(void *context, uint8_t, uint8_t value)
+{
+    TMC5160_Emulator *self = static_cast<TMC5160_Emulator *>(context);
+
+    if (value == LOW) {
+        if (self->_selected)
+            return;
+
+        self->update();
+        self->_selected = true;
+        self->_spiShift = ((uint64_t)self->getSpiStatus().bytes << 32) | self->_spiReadData;
+        self->_spiBytes = 0;
+    } else if (self->_selected) {
+        self->_selected = false;
+
+        // The last 40 bits shifted in are latched ; shorter accesses are ignored
+        if (self->_spiBytes >= 5)
+            self->_processSpiDatagram();
+    }
+}
+
+uint8_t TMC5160_Emulator::spiTransfer(uint8_t mosi)
+{
+    uint8_t miso = (_spiShift >> 32) & 0xFF;
+    _spiShift = ((_spiShift << 8) | mosi) & SPI_DATAGRAM_MASK;
+    if (_spiBytes < 0xFF)
+        _spiBytes++;
+    return miso;
+}
+
+void TMC5160_Emulator::_processSpiDatagram()
+{
+    uint8_t address = (_spiShift >> 32) & 0xFF;
+    uint32_t data = _spiShift & 0xFFFFFFFF;
+
+    update();
+
+    if (address & 0x80) {
+        _write(address & 0x7F, data);
+        _spiReadData = data;  // The next reply mirrors the written data
+    } else {
+        _spiReadData = _read(address);
+    }
+
+    _spiDatagrams++;
+}
+
+/* UART */
+
+void TMC5160_Emulator::uartReceive(uint8_t byte, TMC5160_EmulatedSerial &line)
+{
+    uint64_t now = hostMicros();
+
+    // A pause of more than 63 bit times resets the receiver (now is the end of this byte)
+    if (_uartLength > 0 && now - _uartLastByteMicros > line.bitsToMicros(UART_RESET_BITS + 10))
+        _uartLength = 0;
+    _uartLastByteMicros = now;
+
+    if (_uartLength == 0 && (byte & 0x0F) != UART_SYNC)
+        return;
+
+    _uartBuffer[_uartLength++] = byte;
+
+    uint8_t expected = (_uartLength >= 3 && (_uartBuffer[2] & 0x80)) ? 8 : 4;
+    if (_uartLength < 3 || _uartLength < expected)
+        return;
+
+    _processUartDatagram(line);
+    _uartLength = 0;
+}
+
+void TMC5160_Emulator::_processUartDatagram(TMC5160_EmulatedSerial &line)
+{
+    uint8_t length = _uartLength;
+
+    if (_crc8(_uartBuffer, length - 1) != _uartBuffer[length - 1])
+        return;
+
+    if (_uartBuffer[1] != getUartAddress())
+        return;
+
+    if (_dropDatagrams > 0) {
+        if (_dropAfter > 0) {
+            _dropAfter--;
+        } else {
+            _dropDatagrams--;
+            return;
+        }
+    }
+
+    _uartDatagrams++;
+    uint8_t address = _uartBuffer[2] & 0x7F;
+    update();
+
+    if (_uartBuffer[2] & 0x80) {
+        uint32_t data = ((uint32_t)_uartBuffer[3] << 24) | ((uint32_t)_uartBuffer[4] << 16) |
+                        ((uint32_t)_uartBuffer[5] << 8) | _uartBuffer[6];
+        _write(address, data);
+        _registers[ADDRESS_IFCNT] = (_registers[ADDRESS_IFCNT] + 1) & 0xFF;
+        return;
+    }
+
+    uint32_t data = _read(address);
+    uint8_t reply[8] = { UART_SYNC, UART_MASTER_ADDRESS, address, (uint8_t)(data >> 24), (uint8_t)(data >> 16),
+                         (uint8_t)(data >> 8), (uint8_t)data, 0 };
+    reply[7] = _crc8(reply, 7);
+
+    if (_corruptReplies > 0) {
+        _corruptReplies--;
+        reply[7] ^= 0xFF;
+    }
+
+    // SENDDELAY : 0, 1 : 8 bit times ; 2, 3 : 3*8 bit times ; ... 14, 15 : 15*8 bit times
+    SLAVECONF_Register slaveConf;
+    slaveConf.bytes = _registers[ADDRESS_SLAVECONF];
+    line.reply(reply, sizeof(reply), 8 * (slaveConf.senddelay | 1));
+}
+
+/* Ramp generator
+ *
+ * The velocity (2^-17 VACTUAL units) changes by the acceleration register value on each clock and
+ * the position (2^-41 microsteps) by the velocity, so n clocks of constant acceleration a move the
+ * motor by n * v + a * n * (n + 1) / 2 exactly. Each step integrates one phase, or the part of it
+ * before a ramp event (braking point, arrival) found by bisection on the clock count. */
+
+uint32_t TMC5160_Emulator::_rampRegister(uint8_t address) const
+{
+    uint32_t value = _registers[address];
+
+    switch (address) {
+    case ADDRESS_RAMPMODE: return value & 0x03;
+    case ADDRESS_VSTART:
+    case ADDRESS_VSTOP: return value & 0x3FFFF;
+    case ADDRESS_V_1: return value & 0xFFFFF;
+    case ADDRESS_VMAX: return value & 0x7FFFFF;
+    default: return value & 0xFFFF;  // A1, AMAX, DMAX, D1, TZEROWAIT
+    }
+}
+
+void TMC5160_Emulator::update()
+{
+    uint64_t now = _clocksAt(hostMicros());
+    if (now > _clock)
+        _simulate(now - _clock, false);
+}
+
+bool TMC5160_Emulator::isSettled()
+{
+    update();
+    return _settled();
+}
+
+uint64_t TMC5160_Emulator::runUntilSettled(uint64_t maxMicros)
+{
+    update();
+    uint64_t clocks = _simulate(_clocksAt(maxMicros), true);
+
+    // Whole microseconds : the ramp catches up with the rest on the next update
+    uint64_t elapsed = (clocks * 1000000 + _fclk - 1) / _fclk;
+    for (uint64_t left = elapsed; left > 0;) {
+        uint32_t step = left > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)left;
+        hostAdvanceMicros(step);
+        left -= step;
+    }
+
+    update();
+    return elapsed;
+}
+
+uint64_t TMC5160_Emulator::_simulate(uint64_t clocks, bool stopWhenSettled)
+{
+    uint64_t done = 0;
+
+    for (uint32_t i = 0; done < clocks; i++) {
+        if (stopWhenSettled && _settled())
+            break;
+
+        if (i >= MAX_RAMP_ITERATIONS) {
+            _clock += clocks - done;  // Give up on this interval rather than hang the host program
+            done = clocks;
+            break;
+        }
+
+        uint64_t step = clocks - done < MAX_STEP_CLOCKS ? clocks - done : MAX_STEP_CLOCKS;
+        int64_t vMax = (int64_t)_rampRegister(ADDRESS_VMAX) << VELOCITY_SHIFT;
+
+        switch (_rampRegister(ADDRESS_RAMPMODE)) {
+        case 1: step = _velocityStep(step, vMax, _rampRegister(ADDRESS_AMAX)); break;
+        case 2: step = _velocityStep(step, -vMax, _rampRegister(ADDRESS_AMAX)); break;
+        case 3: _move(step, 0); break;  // Hold mode keeps the current velocity
+        default: step = _positioningStep(step); break;
+        }
+
+        done += step;
+    }
+
+    _updateStatus();
+    return done;
+}
+
+bool TMC5160_Emulator::_settled() const
+{
+    int64_t vMax = (int64_t)_rampRegister(ADDRESS_VMAX) << VELOCITY_SHIFT;
+
+    switch (_rampRegister(ADDRESS_RAMPMODE)) {
+    case 1: return _velocity == vMax || _rampRegister(ADDRESS_AMAX) == 0;
+    case 2: return _velocity == -vMax || _rampRegister(ADDRESS_AMAX) == 0;
+    case 3: return true;
+    default:
+        return _velocity == 0 && _zeroWait == 0 &&
+               (vMax == 0 || _registers[ADDRESS_XACTUAL] == _registers[ADDRESS_XTARGET]);
+    }
+}
+
+// Velocity modes : AMAX towards the target velocity, for both acceleration and deceleration
+uint64_t TMC5160_Emulator::_velocityStep(uint64_t clocks, int64_t target, uint32_t acceleration)
+{
+    _zeroWait = 0;
+    _braking = false;
+
+    int64_t difference = target - _velocity;
+    if (difference == 0 || acceleration == 0) {
+        _move(clocks, 0);
+        return clocks;
+    }
+
+    uint64_t n = (uint64_t)(difference > 0 ? difference : -difference) / acceleration;
+    if (n == 0) {
+        _velocity = target;  // Last, partial increment
+        return 0;
+    }
+
+    if (n > clocks)
+        n = clocks;
+    _move(n, difference > 0 ? (int64_t)acceleration : -(int64_t)acceleration);
+    return n;
+}
+
+/* Positioning mode : VSTART, A1 up to V1, AMAX up to VMAX, then DMAX down to V1 and D1 down to
+ * VSTOP at the braking point, so that the motor stops on XTARGET. A target behind the motor makes
+ * it ramp down and stop (second_move), wait TZEROWAIT and start again in the other direction. */
+uint64_t TMC5160_Emulator::_positioningStep(uint64_t clocks)
+{
+    int64_t vMax = (int64_t)_rampRegister(ADDRESS_VMAX) << VELOCITY_SHIFT;
+    double remaining = _remaining(0, 0);
+
+    if (_velocity == 0) {
+        if (_zeroWait > 0) {
+            uint64_t n = clocks < _zeroWait ? clocks : _zeroWait;
+            _zeroWait -= n;
+            _move(n, 0);
+            return n;
+        }
+
+        if (_registers[ADDRESS_XACTUAL] == _registers[ADDRESS_XTARGET] || vMax == 0) {
+            _positionFraction = 0;
+            _braking = false;
+            _move(clocks, 0);
+            return clocks;
+        }
+
+        _velocity = (remaining > 0 ? 1 : -1) * ((int64_t)_rampRegister(ADDRESS_VSTART) << VELOCITY_SHIFT);
+        _braking = false;
+    }
+
+    int8_t direction = _velocity > 0 ? 1 : _velocity < 0 ? -1 : remaining > 0 ? 1 : -1;
+    int64_t speed = _velocity * direction;
+
+    if (remaining * direction < 0 || vMax == 0)
+        return _decelerate(clocks, direction, false);
+    if (_braking)
+        return _decelerate(clocks, direction, true);
+
+    // Acceleration (or deceleration when VMAX was lowered) until the braking point
+    int64_t v1 = (int64_t)_rampRegister(ADDRESS_V_1) << VELOCITY_SHIFT;
+    int64_t acceleration = 0;
+    int64_t end = vMax;
+    uint64_t n = clocks;
+
+    if (speed < vMax) {
+        bool firstPhase = v1 != 0 && speed < v1;
+        acceleration = _rampRegister(firstPhase ? ADDRESS_A_1 : ADDRESS_AMAX);
+        end = firstPhase && v1 < vMax ? v1 : vMax;
+    } else if (speed > vMax) {
+        acceleration = -(int64_t)_rampRegister(v1 != 0 && speed <= v1 ? ADDRESS_D_1 : ADDRESS_DMAX);
+    }
+
+    if (acceleration != 0) {
+        n = (uint64_t)((end - speed) / acceleration);
+        if (n == 0) {
+            _velocity = direction * end;
+            return 0;
+        }
+        if (n > clocks)
+            n = clocks;
+    }
+
+    uint64_t brakingPoint = _firstClock(n, direction * acceleration, direction, true);
+    if (brakingPoint <= n) {
+        _move(brakingPoint, direction * acceleration);
+        _braking = true;
+        return brakingPoint;
+    }
+
+    _move(n, direction * acceleration);
+    return n;
+}
+
+// DMAX down to V1, D1 down to VSTOP, then stop ; on XTARGET if toTarget
+uint64_t TMC5160_Emulator::_decelerate(uint64_t clocks, int8_t direction, bool toTarget)
+{
+    int64_t speed = _velocity * direction;
+    int64_t v1 = (int64_t)_rampRegister(ADDRESS_V_1) << VELOCITY_SHIFT;
+    uint32_t vStopRegister = _rampRegister(ADDRESS_VSTOP);
+    int64_t vStop = (int64_t)(vStopRegister != 0 ? vStopRegister : 1) << VELOCITY_SHIFT;
+
+    if (speed <= vStop) {
+        if (!toTarget) {
+            _stop(false);
+            return 0;
+        }
+
+        // Final approach at constant velocity
+        if (speed == 0)
+            _velocity = direction * vStop;
+
+        uint64_t arrival = _firstClock(clocks, 0, direction, false);
+        if (arrival <= clocks) {
+            _move(arrival, 0);
+            _stop(true);
+            return arrival;
+        }
+
+        _move(clocks, 0);
+        return clocks;
+    }
+
+    bool firstPhase = v1 == 0 || speed > v1;
+    uint32_t deceleration = _rampRegister(firstPhase ? ADDRESS_DMAX : ADDRESS_D_1);
+    int64_t end = firstPhase && v1 > vStop ? v1 : vStop;
+
+    uint64_t n = deceleration != 0 ? (uint64_t)(speed - end) / deceleration : 0;
+    if (n == 0) {
+        _velocity = direction * end;
+        return 0;
+    }
+
+    if (n > clocks)
+        n = clocks;
+    int64_t acceleration = -direction * (int64_t)deceleration;
+
+    if (toTarget) {
+        uint64_t arrival = _firstClock(n, acceleration, direction, false);
+        if (arrival <= n) {
+            _move(arrival, acceleration);
+            _stop(true);
+            return arrival;
+        }
+    }
+
+    _move(n, acceleration);
+    return n;
+}
+
+void TMC5160_Emulator::_move(uint64_t clocks, int64_t acceleration)
+{
+    if (clocks == 0)
+        return;
+
+    int64_t delta = (int64_t)clocks * _velocity + acceleration * (int64_t)(clocks * (clocks + 1) / 2);
+    _velocity += acceleration * (int64_t)clocks;
+
+    int64_t fraction = _positionFraction + delta;
+    int64_t steps = fraction >> POSITION_SHIFT;  // Floor
+    _positionFraction = fraction - steps * (1LL << POSITION_SHIFT);
+    _registers[ADDRESS_XACTUAL] += (uint32_t)steps;
+
+    _clock += clocks;
+}
+
+double TMC5160_Emulator::_remaining(uint64_t clocks, int64_t acceleration) const
+{
+    int64_t delta = (int64_t)clocks * _velocity + acceleration * (int64_t)(clocks * (clocks + 1) / 2);
+    int32_t distance = (int32_t)(_registers[ADDRESS_XTARGET] - _registers[ADDRESS_XACTUAL]);
+
+    return distance - (double)(_positionFraction + delta) / (double)(1LL << POSITION_SHIFT);
+}
+
+double TMC5160_Emulator::_brakeDistance(int64_t speed) const
+{
+    uint32_t vStopRegister = _rampRegister(ADDRESS_VSTOP);
+    double vStop = (double)((int64_t)(vStopRegister != 0 ? vStopRegister : 1) << VELOCITY_SHIFT);
+    double v1 = (double)((int64_t)_rampRegister(ADDRESS_V_1) << VELOCITY_SHIFT);
+    double dMax = _rampRegister(ADDRESS_DMAX);
+    double d1 = _rampRegister(ADDRESS_D_1);
+    double v = (double)speed;
+
+    if (v <= vStop)
+        return 0;
+
+    // v^2 / 2d per phase, like _decelerate
+    double distance = 0;
+    if (v1 != 0 && v > v1 && v1 > vStop) {
+        if (dMax > 0)
+            distance += (v * v - v1 * v1) / (2 * dMax);
+        v = v1;
+    }
+
+    double d = v1 == 0 || v > v1 ? dMax : d1;
+    if (d > 0)
+        distance += (v * v - vStop * vStop) / (2 * d);
+
+    return distance / (double)(1LL << POSITION_SHIFT);
+}
+
+// First clock in 0 .. clocks at the braking point or on the target, clocks + 1 if none
+uint64_t TMC5160_Emulator::_firstClock(uint64_t clocks, int64_t acceleration, int8_t direction,
+                                       bool brakePoint) const
+{
+    auto reached = [&](uint64_t clock) {
+        double limit = 0;
+        if (brakePoint) {
+            int64_t velocity = _velocity + acceleration * (int64_t)clock;
+            limit = _brakeDistance(velocity < 0 ? -velocity : velocity);
+        }
+        return direction * _remaining(clock, acceleration) <= limit;
+    };
+
+    if (reached(0))
+        return 0;
+    if (!reached(clocks))
+        return clocks + 1;
+
+    uint64_t low = 0, high = clocks;
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        if (reached(middle))
+            high = middle;
+        else
+            low = middle;
+    }
+
+    return high;
+}
+
+void TMC5160_Emulator::_stop(bool atTarget)
+{
+    _velocity = 0;
+    _braking = false;
+    _zeroWait = _rampRegister(ADDRESS_TZEROWAIT) * TZEROWAIT_CLOCKS;
+
+    if (atTarget) {
+        _registers[ADDRESS_XACTUAL] = _registers[ADDRESS_XTARGET];
+        _positionFraction = 0;
+    } else if (_rampRegister(ADDRESS_VMAX) != 0) {
+        RAMP_STAT_Register rampStat;
+        rampStat.bytes = _registers[ADDRESS_RAMP_STAT];
+        rampStat.second_move = true;
+        _registers[ADDRESS_RAMP_STAT] = rampStat.bytes;
+    }
+}
+
+/* Serial line */
+
+TMC5160_EmulatedSerial::TMC5160_EmulatedSerial(uint32_t baudRate)
+: _baudRate(baudRate), _nanosRemainder(0), _slaveCount(0), _rxHead(0), _rxCount(0)
+{
+}
+
+void TMC5160_EmulatedSerial::begin(uint32_t baudRate)
+{
+    _baudRate = baudRate != 0 ? baudRate : 1;
+}
+
+bool TMC5160_EmulatedSerial::attach(TMC5160_Emulator &emulator)
+{
+    if (_slaveCount >= MAX_SLAVES)
+        return false;
+
+    _slaves[_slaveCount++] = &emulator;
+    return true;
+}
+
+size_t TMC5160_EmulatedSerial::write(uint8_t byte)
+{
+    // Start bit, 8 data bits, stop bit
+    _nanosRemainder += 10 * 1000000000ULL / _baudRate;
+    hostAdvanceMicros(_nanosRemainder / 1000);
+    _nanosRemainder %= 1000;
+
+    for (uint8_t i = 0; i < _slaveCount; i++)
+        _slaves[i]->uartReceive(byte, *this);
+
+    return 1;
+}
+
+void TMC5160_EmulatedSerial::reply(const uint8_t *bytes, uint8_t length, uint32_t delayBits)
+{
+    uint64_t start = hostMicros() + bitsToMicros(delayBits);
+
+    for (uint8_t i = 0; i < length && _rxCount < RX_QUEUE_LENGTH; i++) {
+        RxByte &rx = _rxQueue[(_rxHead + _rxCount) % RX_QUEUE_LENGTH];
+        rx.data = bytes[i];
+        rx.time = start + bitsToMicros(10 * (i + 1));
+        _rxCount++;
+    }
+}
+
+int TMC5160_EmulatedSerial::available()
+{
+    uint64_t now = hostMicros();
+    int count = 0;
+
+    while (count < _rxCount && _rxQueue[(_rxHead + count) % RX_QUEUE_LENGTH].time <= now)
+        count++;
+
+    return count;
+}
+
+int TMC5160_EmulatedSerial::read()
+{
+    if (available() == 0)
+        return -1;
+
+    uint8_t data = _rxQueue[_rxHead].data;
+    _rxHead = (_rxHead + 1) % RX_QUEUE_LENGTH;
+    _rxCount--;
+    return data;
+}
+
+int TMC5160_EmulatedSerial::peek()
+{
+    return available() > 0 ? _rxQueue[_rxHead].data : -1;
+}
@@ -0,0 +1,208 @@
+/* Emulated TMC5160 for host builds.
+ *
+ * Register file with the access semantics of the chip : read-only and write-only registers,
+ * R+WC flags (GSTAT, RAMP_STAT, ENC_STATUS) cleared by writing 1, IOIN / OUTPUT sharing one
+ * address. The library drives it unmodified through the host SPI and Stream shims :
+ *
+ * SPI : 40-bit shift register latched on the chip select rising edge. The reply carries the
+ * SPI status byte and the data read by the previous datagram, or the data of the previous write.
+ * Emulators selected by the same chip select pin form a daisy chain, in attach order.
+ *
+ * The register map and the UART CRC are implemented from the datasheet, independently of the
+ * library.
+ *
+ * UART : 4-byte read requests and 8-byte write datagrams with sync nibble, slave address
+ * (SLAVECONF + NAI) and CRC8 check ; IFCNT counts the valid writes. Replies are 8-byte datagrams
+ * sent SENDDELAY bit times after the request. A pause of more than 63 bit times resets the
+ * receiver, like on the chip.
+ *
+ * Motion : the ramp generator (RAMPMODE, VSTART, A1, V1, AMAX, VMAX, DMAX, D1, VSTOP, TZEROWAIT)
+ * moves XACTUAL / VACTUAL and the RAMP_STAT flags with the virtual time, integrated exactly at
+ * fclk resolution in fixed point. Phases of constant acceleration are computed in closed form,
+ * so long moves cost a few iterations. runUntilSettled() fast-forwards the virtual time to the
+ * end of the current move.
+ *
+ * DIAG outputs : with setDiagPins(), SWN_DIAG0 (RAMP_STAT and ENC_STATUS events, driver errors with
+ * diag0_error, stall with diag0_stall) and SWP_DIAG1 (stall with diag1_stall) drive host pins, with
+ * the GCONF polarity : active low (open drain) or active high (push-pull).
+ */
+#ifndef TMC5160_EMULATOR_H
+#define TMC5160_EMULATOR_H
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "TMC5160.h"
+
+class TMC5160_EmulatedSerial;
+
+class TMC5160_Emulator : public HostSPIDevice
+{
+  public:
+    static constexpr uint8_t NO_PIN = 0xFF;
+
+    TMC5160_Emulator(uint8_t chipSelectPin = NO_PIN, uint32_t fclk = DEFAULT_F_CLK); // NO_PIN : UART only
+    ~TMC5160_Emulator();
+
+    void attach(SPIClass &spi = SPI);  // Join the SPI bus, selected while the chip select pin is low
+    void powerOn();                    // Reset values, GSTAT.reset set
+
+    /* Register file backdoor, without any access side effect (the ramp is brought up to date).
+     * Address ADDRESS_IO_INPUT_OUTPUT is the IOIN value ; the OUTPUT register is getOutput(). */
+    uint32_t peekRegister(uint8_t address);
+    void pokeRegister(uint8_t address, uint32_t value);
+    uint8_t getOutput() const { return _output; }
+
+    void setNAI(bool nai) { _nai = nai; }  // UART slave address is SLAVECONF.slaveaddr + NAI
+    uint8_t getUartAddress() const;
+
+    /* Fault injection on the UART */
+    void corruptReplies(uint8_t count) { _corruptReplies = count; }  // Send the next replies with a bad CRC
+    void dropDatagrams(uint8_t count, uint8_t after = 0)              // Ignore count datagrams for this chip,
+    {                                                                 // once after more were received
+        _dropDatagrams = count;
+        _dropAfter = after;
+    }
+
+    void setDiagPins(uint8_t diag0Pin, uint8_t diag1Pin = NO_PIN);  // hostSetPinInput() on level changes
+
+    uint32_t getSpiDatagramCount() const { return _spiDatagrams; }
+    uint32_t getUartDatagramCount() const { return _uartDatagrams; }
+
+    SPI_STATUS_Register getSpiStatus() const;
+
+    /* Ramp generator */
+    void update();  // Advance the ramp generator to the current virtual time
+    /* Advance the virtual time until the ramp settles : target reached and TZEROWAIT elapsed in
+     * positioning mode, VMAX reached in velocity mode. Returns the time elapsed (us), about
+     * maxMicros if it did not settle. */
+    uint64_t runUntilSettled(uint64_t maxMicros = 60000000);
+    bool isSettled();
+
+    /* HostSPIDevice */
+    bool spiSelected() const { return _selected; }
+    uint8_t spiTransfer(uint8_t mosi);
+
+    /* Called by TMC5160_EmulatedSerial for each byte on the line */
+    void uartReceive(uint8_t byte, TMC5160_EmulatedSerial &line);
+
+  private:
+    static constexpr uint64_t SPI_DATAGRAM_MASK = 0xFFFFFFFFFFULL;  // 40 bits
+    static constexpr uint8_t UART_SYNC = 0x05;                     // Low nibble, the high one is don't care
+    static constexpr uint8_t UART_MASTER_ADDRESS = 0xFF;
+    static constexpr uint8_t UART_RESET_BITS = 63;
+
+    // R+WC bits
+    static constexpr uint32_t GSTAT_CLEAR_MASK = 0x07;
+    static constexpr uint32_t RAMP_STAT_CLEAR_MASK = 0x10CC;  // status_latch_l/r, event_stop_sg, event_pos_reached, second_move
+    static constexpr uint32_t ENC_STATUS_CLEAR_MASK = 0x03;
+
+    uint32_t _registers[REGISTER_ADDRESS_COUNT];
+    uint8_t _output;
+
+    /* Ramp generator state, in fclk cycles.
+     * Velocity in 2^-17 VACTUAL units : the acceleration registers add to it once per cycle.
+     * Position fraction in 2^-41 microsteps : the velocity adds to it once per cycle. */
+    static constexpr uint8_t VELOCITY_SHIFT = 17;
+    static constexpr uint8_t POSITION_SHIFT = 41;
+    static constexpr uint32_t TZEROWAIT_CLOCKS = 512;
+    static constexpr uint64_t MAX_STEP_CLOCKS = 1UL << 20;  // Keeps the position sum within 64 bits
+
+    static constexpr uint32_t MAX_RAMP_ITERATIONS = 1000000;
+
+    uint32_t _fclk;
+    uint64_t _clock;
+    int64_t _velocity;
+    int64_t _positionFraction;  // 0 .. 2^41 - 1
+    uint32_t _zeroWait;         // Clocks left
+    bool _braking;              // Positioning : the deceleration towards XTARGET has started
+
+    uint64_t _clocksAt(uint64_t micros) const { return micros * _fclk / 1000000; }
+    uint32_t _rampRegister(uint8_t address) const;
+    uint64_t _simulate(uint64_t clocks, bool stopWhenSettled);
+    bool _settled() const;
+    uint64_t _velocityStep(uint64_t clocks, int64_t target, uint32_t acceleration);
+    uint64_t _positioningStep(uint64_t clocks);
+    uint64_t _decelerate(uint64_t clocks, int8_t direction, bool toTarget);
+    void _move(uint64_t clocks, int64_t acceleration);
+    double _remaining(uint64_t clocks, int64_t acceleration) const;  // Microsteps to XTARGET after clocks
+    double _brakeDistance(int64_t speed) const;                      // Microsteps to slow down to VSTOP
+    uint64_t _firstClock(uint64_t clocks, int64_t acceleration, int8_t direction, bool brakePoint) const;
+    void _stop(bool atTarget);
+
+    uint8_t _chipSelectPin;
+    SPIClass *_spi;
+    bool _selected;
+    uint64_t _spiShift;
+    uint8_t _spiBytes;
+    uint32_t _spiReadData;
+    uint32_t _spiDatagrams;
+
+    bool _nai;
+    uint8_t _uartBuffer[8];
+    uint8_t _uartLength;
+    uint64_t _uartLastByteMicros;
+    uint8_t _corruptReplies;
+    uint8_t _dropDatagrams;
+    uint8_t _dropAfter;
+    uint32_t _uartDatagrams;
+
+    uint8_t _diagPins[2];
+    int8_t _diagLevels[2];  // Last level driven, -1 : none yet
+
+    static void _onChipSelect(void *context, uint8_t pin, uint8_t value);
+    void _processSpiDatagram();
+    void _processUartDatagram(TMC5160_EmulatedSerial &line);
+
+    static uint8_t _access(uint8_t address);                     // REG_READ / REG_WRITE / REG_CLEAR
+    static uint8_t _crc8(const uint8_t *data, uint8_t length);
+
+    uint32_t _read(uint8_t address);
+    void _write(uint8_t address, uint32_t data);
+    void _updateStatus();
+    void _updateDiagOutputs();
+};
+
+/* MCU side of the serial line to one or more emulated chips (pass it to TMC5160_UART).
+ * Sending a byte takes 10 bit times of virtual time ; reply bytes become available when they
+ * would have been received. */
+class TMC5160_EmulatedSerial : public Stream
+{
+  public:
+    static constexpr uint8_t MAX_SLAVES = 8;
+
+    TMC5160_EmulatedSerial(uint32_t baudRate = 115200);
+
+    void begin(uint32_t baudRate);
+    uint32_t getBaudRate() const { return _baudRate; }
+    bool attach(TMC5160_Emulator &emulator);
+
+    size_t write(uint8_t byte);
+    using Print::write;
+    int available();
+    int read();
+    int peek();
+
+    /* Used by the emulator : queue a reply starting delayBits bit times after the last byte sent */
+    void reply(const uint8_t *bytes, uint8_t length, uint32_t delayBits);
+    uint64_t bitsToMicros(uint32_t bits) const { return (uint64_t)bits * 1000000ULL / _baudRate; }
+
+  private:
+    static constexpr uint8_t RX_QUEUE_LENGTH = 64;
+
+    struct RxByte {
+        uint8_t data;
+        uint64_t time;  // Virtual time the byte is completely received
+    };
+
+    uint32_t _baudRate;
+    uint64_t _nanosRemainder;
+    TMC5160_Emulator *_slaves[MAX_SLAVES];
+    uint8_t _slaveCount;
+
+    RxByte _rxQueue[RX_QUEUE_LENGTH];
+    uint8_t _rxHead;
+    uint8_t _rxCount;
+};
+
+#endif // TMC5160_EMULATOR_H
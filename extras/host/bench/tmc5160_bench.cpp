@@ -0,0 +1,256 @@
+/* Host micro-benchmarks of the library hot paths.
+ *
+ *   tmc5160_bench [name filter]
+ *
+ * Prints one CSV line per benchmark :
+ *   benchmark,iterations,ns_per_op,transactions_per_op
+ * ns_per_op is wall clock time on the host, transactions_per_op the datagrams exchanged with the
+ * mock transports, which answer immediately : the figures are the library's own CPU cost.
+ * BENCH_MIN_MS (default 200) sets the minimum duration of each benchmark.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "TMC5160.h"
+#include "TMC5160T.h"
+
+static volatile uint32_t sink;  // Keeps the benchmarked results alive
+
+/* SPI slave that is always selected and answers zeros */
+class MockSpiDevice : public HostSPIDevice
+{
+  public:
+    MockSpiDevice() : bytes(0) {}
+
+    bool spiSelected() const { return true; }
+    uint8_t spiTransfer(uint8_t) { bytes++; return 0; }
+
+    uint64_t bytes;
+};
+
+/* UART transport whose chip replies to a read request as soon as it is sent.
+ * Replies are precomputed, except IFCNT which counts the write datagrams. */
+class MockUart : public TMC5160_UART_Generic
+{
+  public:
+    MockUart() : datagrams(0), _writes(0), _replyLength(0), _replyIndex(0)
+    {
+        for (uint8_t address = 0; address < 0x80; address++)
+            _buildReply(_replies[address], address, 0x12345600 | address);
+    }
+
+    uint64_t datagrams;
+
+  protected:
+    void uartFlushInput() { _replyLength = _replyIndex = 0; }
+
+    void uartWriteBytes(const uint8_t *buf, uint8_t len)
+    {
+        for (uint8_t i = 0; i < len;) {
+            uint8_t address = buf[i + 2];
+            datagrams++;
+
+            if (address & 0x80) {
+                _writes++;
+                i += 8;
+                continue;
+            }
+
+            if (address == ADDRESS_IFCNT)
+                _buildReply(_reply, address, _writes & 0xFF);
+            else
+                memcpy(_reply, _replies[address & 0x7F], 8);
+            _replyLength = 8;
+            _replyIndex = 0;
+            i += 4;
+        }
+    }
+
+    int uartReadBytes(uint8_t *buf, uint8_t len)
+    {
+        int count = 0;
+        while (count < len && _replyIndex < _replyLength)
+            buf[count++] = _reply[_replyIndex++];
+        return count;
+    }
+
+    uint8_t uartReadByte() { return _replyIndex < _replyLength ? _reply[_replyIndex++] : 0xFF; }
+    int uartBytesAvailable() { return _replyLength - _replyIndex; }
+
+  private:
+    uint32_t _writes;
+    uint8_t _replies[0x80][8];
+    uint8_t _reply[8];
+    uint8_t _replyLength;
+    uint8_t _replyIndex;
+
+    static void _buildReply(uint8_t *reply, uint8_t address, uint32_t data)
+    {
+        reply[0] = 0x05;
+        reply[1] = 0xFF;
+        reply[2] = address;
+        reply[3] = data >> 24;
+        reply[4] = data >> 16;
+        reply[5] = data >> 8;
+        reply[6] = data;
+        reply[7] = crc8(reply, 7);
+    }
+};
+
+/* Exposes the unit conversions */
+class BenchSpi : public TMC5160_SPI
+{
+  public:
+    BenchSpi() : TMC5160_SPI(10) {}
+
+    using TMC5160::accelFromHz;
+    using TMC5160::speedFromHz;
+    using TMC5160::speedToHz;
+    using TMC5160::thrsSpeedToTstep;
+};
+
+/* Same chip, conversions and transport specialized at compile time */
+typedef TMC5160T<DEFAULT_F_CLK, 256, TMC5160_SPI> SpiMotorT;
+
+static MockSpiDevice spiDevice;
+static BenchSpi spiMotor;
+static SpiMotorT spiMotorT(11);
+static MockUart uartMotor;
+
+/* Benchmarks : run the operation once per call, with i as a varying input */
+
+static void benchSpeedToHz(uint32_t i) { sink = (uint32_t)spiMotor.speedToHz(i & 0x7FFFFF); }
+static void benchSpeedFromHz(uint32_t i) { sink = spiMotor.speedFromHz((float)(i & 0xFFFF)); }
+static void benchAccelFromHz(uint32_t i) { sink = spiMotor.accelFromHz((float)(i & 0xFFFF)); }
+static void benchSpeedFromMicrosteps(uint32_t i) { sink = spiMotor.speedFromMicrosteps((int32_t)(i & 0xFFFFFF) - 0x800000); }
+static void benchAccelFromMicrosteps(uint32_t i) { sink = spiMotor.accelFromMicrosteps(i & 0xFFFFFF); }
+static void benchThrsSpeedToTstep(uint32_t i) { sink = spiMotor.thrsSpeedToTstep((float)(1 + (i & 0xFFFF))); }
+static void benchSetCurrentMilliamps(uint32_t i) { spiMotor.setCurrentMilliamps(500 + (i & 0x7FF)); }
+static void benchSetEncoderResolution(uint32_t i) { sink = spiMotor.setEncoderResolution(200, (i & 1) ? 4000 : 4096); }
+
+static void benchCrc8(uint32_t i)
+{
+    uint8_t datagram[7] = { 0x05, 0x00, (uint8_t)(0x80 | (i & 0x7F)), (uint8_t)(i >> 24), (uint8_t)(i >> 16),
+                            (uint8_t)(i >> 8), (uint8_t)i };
+    sink = TMC5160_UART_Generic::crc8(datagram, sizeof(datagram));
+}
+
+static void benchSpiRead(uint32_t i) { sink = spiMotor.readRegister(ADDRESS_XACTUAL + (i & 1)); }
+static void benchSpiWrite(uint32_t i) { spiMotor.writeRegister(ADDRESS_XTARGET, i); }
+
+static void benchMoveAtVelocity(uint32_t i) { spiMotor.moveAtVelocity((float)(i & 0xFFFF) - 32768.0f); }
+static void benchMoveAtVelocityRaw(uint32_t i) { spiMotor.moveAtVelocityRaw(spiMotor.speedFromMicrosteps((int32_t)(i & 0xFFFFFF) - 0x800000)); }
+
+static void benchSpeedFromHzT(uint32_t i) { sink = SpiMotorT::speedFromHz((float)(i & 0xFFFF)); }
+static void benchMoveAtVelocityT(uint32_t i) { spiMotorT.moveAtVelocity((float)(i & 0xFFFF) - 32768.0f); }
+static void benchMoveAtVelocityRawT(uint32_t i) { spiMotorT.moveAtVelocityRaw(SpiMotorT::speedFromMicrosteps((int32_t)(i & 0xFFFFFF) - 0x800000)); }
+static void benchSetAccelerationsT(uint32_t i) { spiMotorT.setAccelerations(1000 + (i & 0xFF), 2000, 1000, 3000); }
+static void benchSetAccelerations(uint32_t i) { spiMotor.setAccelerations(1000 + (i & 0xFF), 2000, 1000, 3000); }
+
+static void benchSpiReadBurst(uint32_t)
+{
+    static const uint8_t addresses[4] = { ADDRESS_XACTUAL, ADDRESS_VACTUAL, ADDRESS_RAMP_STAT, ADDRESS_DRV_STATUS };
+    uint32_t values[4];
+    spiMotor.readRegisters(addresses, values, 4);
+    sink = values[0];
+}
+
+static void benchUartWriteDatagram(uint32_t i) { uartMotor.writeRegister(ADDRESS_XTARGET, i); }
+static void benchUartRead(uint32_t i) { sink = uartMotor.readRegister(ADDRESS_XACTUAL + (i & 1)); }
+
+struct Benchmark {
+    const char *name;
+    void (*run)(uint32_t i);
+    void (*setup)();
+};
+
+static void setupNothing() {}
+static void setupVelocityMode() { spiMotor.setRampMode(VELOCITY_MODE); }
+static void setupVelocityModeT() { spiMotorT.setRampMode(VELOCITY_MODE); }
+static void setupStreaming() { uartMotor.setCommunicationMode(TMC5160_UART_Generic::STREAMING_MODE); }
+static void setupReliable() { uartMotor.setCommunicationMode(TMC5160_UART_Generic::RELIABLE_MODE); }
+
+static const Benchmark BENCHMARKS[] = {
+    { "speed_to_hz", benchSpeedToHz, setupNothing },
+    { "speed_from_hz", benchSpeedFromHz, setupNothing },
+    { "accel_from_hz", benchAccelFromHz, setupNothing },
+    { "speed_from_microsteps", benchSpeedFromMicrosteps, setupNothing },
+    { "accel_from_microsteps", benchAccelFromMicrosteps, setupNothing },
+    { "thrs_speed_to_tstep", benchThrsSpeedToTstep, setupNothing },
+    { "set_current_milliamps", benchSetCurrentMilliamps, setupNothing },
+    { "set_encoder_resolution", benchSetEncoderResolution, setupNothing },
+    { "uart_crc8", benchCrc8, setupNothing },
+    { "spi_read_register", benchSpiRead, setupNothing },
+    { "spi_write_register", benchSpiWrite, setupNothing },
+    { "spi_move_at_velocity", benchMoveAtVelocity, setupVelocityMode },
+    { "spi_move_at_velocity_raw", benchMoveAtVelocityRaw, setupVelocityMode },
+    { "spi_set_accelerations", benchSetAccelerations, setupNothing },
+    { "template_speed_from_hz", benchSpeedFromHzT, setupNothing },
+    { "template_move_at_velocity", benchMoveAtVelocityT, setupVelocityModeT },
+    { "template_move_at_velocity_raw", benchMoveAtVelocityRawT, setupVelocityModeT },
+    { "template_set_accelerations", benchSetAccelerationsT, setupNothing },
+    { "spi_read_registers_4", benchSpiReadBurst, setupNothing },
+    { "uart_write_datagram", benchUartWriteDatagram, setupStreaming },
+    { "uart_read_register", benchUartRead, setupStreaming },
+    { "uart_reliable_write", benchUartWriteDatagram, setupReliable },
+    { "uart_reliable_read", benchUartRead, setupReliable },
+};
+
+static uint64_t transactions()
+{
+    return spiDevice.bytes / 5 + uartMotor.datagrams;
+}
+
+static void runBenchmark(const Benchmark &benchmark, double minSeconds)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    benchmark.setup();
+
+    // Warm up, then double the iteration count until the run is long enough
+    for (uint32_t i = 0; i < 1000; i++)
+        benchmark.run(i);
+
+    uint64_t iterations = 1000;
+    for (;;) {
+        uint64_t startTransactions = transactions();
+        Clock::time_point start = Clock::now();
+
+        for (uint64_t i = 0; i < iterations; i++)
+            benchmark.run((uint32_t)i);
+
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        uint64_t count = transactions() - startTransactions;
+
+        if (seconds >= minSeconds || iterations >= (1ULL << 40)) {
+            printf("%s,%llu,%.2f,%.3f\n", benchmark.name, (unsigned long long)iterations, seconds * 1e9 / iterations,
+                   (double)count / iterations);
+            return;
+        }
+
+        iterations *= 2;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = argc > 1 ? argv[1] : "";
+    const char *minMs = getenv("BENCH_MIN_MS");
+    double minSeconds = (minMs != nullptr ? atof(minMs) : 200.0) / 1000.0;
+
+    SPI.attach(spiDevice);
+    spiMotor.begin();
+    spiMotorT.begin();
+    uartMotor.begin();
+
+    printf("benchmark,iterations,ns_per_op,transactions_per_op\n");
+    for (const Benchmark &benchmark : BENCHMARKS) {
+        if (strstr(benchmark.name, filter) != nullptr)
+            runBenchmark(benchmark, minSeconds);
+    }
+
+    return 0;
+}
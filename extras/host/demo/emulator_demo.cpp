@@ -0,0 +1,274 @@
+/* Drives emulated TMC5160s through the unmodified SPI and UART transports. */
+#include <math.h>
+#include <stdio.h>
+
+#include "TMC5160.h"
+#include "TMC5160_Coordinator.h"
+#include "TMC5160_Emulator.h"
+#include "TMC5160_Events.h"
+#include "TMC5160_MoveQueue.h"
+#include "TMC5160_RampPredictor.h"
+
+static const uint8_t CS_PIN = 10;
+static const uint8_t DIAG0_PIN = 2;
+static const uint8_t DIAG1_PIN = 3;
+
+static void spiDemo()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+
+    TMC5160_SPI motor(CS_PIN);
+    uint64_t startTime = hostMicros();
+    bool ok = motor.begin();
+
+    printf("SPI  begin %s, %u datagrams, %llu us\n", ok ? "ok" : "FAILED", (unsigned)chip.getSpiDatagramCount(),
+           (unsigned long long)(hostMicros() - startTime));
+
+    motor.setRampMode(POSITIONING_MODE);
+    motor.setTargetPosition(200);
+    printf("SPI  XTARGET 0x%08X, GSTAT 0x%X (reset flag cleared by begin)\n",
+           (unsigned)chip.peekRegister(ADDRESS_XTARGET), (unsigned)chip.peekRegister(ADDRESS_GSTAT));
+
+    uint32_t values[3];
+    const uint8_t addresses[3] = { ADDRESS_GCONF, ADDRESS_RAMPMODE, ADDRESS_IO_INPUT_OUTPUT };
+    motor.readRegisters(addresses, values, 3);
+    printf("SPI  GCONF 0x%08X, RAMPMODE %u, IOIN version 0x%02X\n", (unsigned)values[0], (unsigned)values[1],
+           (unsigned)(values[2] >> 24));
+}
+
+static void motionDemo()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+
+    // Two revolutions of a 200 step motor : 0.5 s at 800 steps/s^2 up to 400 steps/s, cruise, 0.5 s down
+    motor.setRampMode(POSITIONING_MODE);
+    motor.setAccelerations(800, 800, 800, 800);
+    motor.moveAtVelocity(400);
+    motor.setTargetPosition(400);
+
+    TMC5160_RampPredictor predictor;
+    predictor.loadParameters(motor);
+    predictor.plan(0, 400 * 256);
+
+    delay(500);
+    printf("Move XACTUAL %d, VACTUAL %d after 500 ms (predicted %d, %d)\n", (int)chip.peekRegister(ADDRESS_XACTUAL),
+           (int)chip.peekRegister(ADDRESS_VACTUAL), (int)predictor.getPosition(micros()),
+           (int)predictor.getVelocity(micros()));
+
+    // Sleep until the predicted arrival, then confirm with one datagram : its status byte
+    unsigned long sleep = predictor.getTimeToTarget();
+    delayMicroseconds(sleep);
+    motor.readRegister(ADDRESS_XACTUAL);
+    bool reached = motor.lastSpiStatus().position_reached;
+    printf("Move XACTUAL %d, position_reached %u after sleeping %lu us\n", (int)chip.peekRegister(ADDRESS_XACTUAL),
+           (unsigned)reached, sleep);
+}
+
+// Three 100 step segments in the same direction, with the queue serviced every ms
+static unsigned long queueRun(bool blend)
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+    motor.setRampMode(POSITIONING_MODE);
+    motor.setAccelerations(800, 800, 800, 800);
+    motor.moveAtVelocity(400);
+
+    TMC5160_MoveQueue queue(motor);
+    for (int32_t step = 100; step <= 300; step += 100)
+        queue.add(step * 256, 0, 0, 0, blend);
+
+    unsigned long startTime = micros();
+    do {
+        queue.service();
+        delay(1);
+    } while (queue.isRunning());
+
+    return micros() - startTime;
+}
+
+static void queueDemo()
+{
+    unsigned long stopAndGo = queueRun(false);
+    unsigned long blended = queueRun(true);
+    printf("Queue 3 segments : %lu us stopping on each target, %lu us blended\n", stopAndGo, blended);
+}
+
+/* XY diagonal of 300 x 100 steps. Independent : both axes get the same ramp.
+ * Prints the worst distance to the straight line and the gap between the arrival times. */
+static void gantryRun(bool coordinated)
+{
+    const uint8_t pins[2] = { CS_PIN, CS_PIN + 1 };
+    const int32_t targets[2] = { 300 * 256, 100 * 256 };
+
+    TMC5160_Emulator chipX(pins[0]), chipY(pins[1]);
+    chipX.attach(SPI);
+    chipY.attach(SPI);
+    TMC5160_Emulator *chips[2] = { &chipX, &chipY };
+
+    TMC5160_SPI axisX(pins[0]), axisY(pins[1]);
+    TMC5160_SPI *axes[2] = { &axisX, &axisY };
+    TMC5160_Coordinator coordinator;
+
+    for (uint8_t i = 0; i < 2; i++) {
+        axes[i]->begin();
+        axes[i]->setRampMode(POSITIONING_MODE);
+        axes[i]->setAccelerations(800, 800, 800, 800);
+        axes[i]->moveAtVelocity(400);
+        coordinator.addAxis(*axes[i]);
+    }
+
+    if (coordinated) {
+        TMC5160_RampPredictor::Parameters path = {};
+        path.amax = path.dmax = path.a1 = path.d1 = axisX.getShadowRegister(ADDRESS_AMAX);
+        path.vmax = axisX.getShadowRegister(ADDRESS_VMAX);
+        path.vstop = 10;
+        coordinator.setPathParameters(path);
+        coordinator.moveTo(targets);
+    } else {
+        for (uint8_t i = 0; i < 2; i++)
+            axes[i]->setTargetPositionMicrosteps(targets[i]);
+    }
+
+    uint64_t startTime = hostMicros();
+    uint64_t arrival[2] = { 0, 0 };
+    double deviation = 0;
+
+    while (arrival[0] == 0 || arrival[1] == 0) {
+        hostAdvanceMicros(1000);
+
+        double position[2];
+        for (uint8_t i = 0; i < 2; i++) {
+            position[i] = (int32_t)chips[i]->peekRegister(ADDRESS_XACTUAL);
+            if (arrival[i] == 0 && position[i] == targets[i])
+                arrival[i] = hostMicros() - startTime;
+        }
+
+        // Distance to the line from the origin to the targets
+        double distance = fabs(position[0] * targets[1] - position[1] * targets[0]) / hypot(targets[0], targets[1]);
+        deviation = distance > deviation ? distance : deviation;
+    }
+
+    printf("Gantry %s : off the line by %.0f microsteps at most, arrivals %llu us apart\n",
+           coordinated ? "coordinated" : "independent", deviation,
+           (unsigned long long)(arrival[0] > arrival[1] ? arrival[0] - arrival[1] : arrival[1] - arrival[0]));
+}
+
+static void onPositionReached(TMC5160 &, void *context)
+{
+    *(unsigned long *)context = micros();
+}
+
+static void onStall(TMC5160 &, void *context)
+{
+    (*(unsigned *)context)++;
+}
+
+// Wait for the end of a move polling RAMP_STAT every millisecond, or on the DIAG0 interrupt
+static void eventsRun(bool interrupt)
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    chip.setDiagPins(DIAG0_PIN, DIAG1_PIN);
+
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+
+    unsigned long reachedTime = 0;
+    unsigned stalls = 0;
+    TMC5160_Events events(motor);
+    events.onPositionReached(onPositionReached, &reachedTime);
+    events.onStall(onStall, &stalls);
+
+    motor.setRampMode(POSITIONING_MODE);
+    motor.setAccelerations(800, 800, 800, 800);
+    motor.moveAtVelocity(400);
+
+    // After the switch to positioning mode : its event_pos_reached is cleared
+    if (interrupt)
+        events.begin(DIAG0_PIN, DIAG1_PIN);
+    motor.setTargetPosition(400);
+
+    TMC5160_RampPredictor predictor;
+    predictor.loadParameters(motor);
+    predictor.plan(0, 400 * 256);
+
+    uint32_t datagrams = chip.getSpiDatagramCount();
+    while (reachedTime == 0 && micros() < predictor.getArrivalTime() + 100000) {
+        delay(1);
+        if (interrupt) {
+            chip.update();  // The chip runs on its own : the emulator needs to be told
+            events.dispatch();
+        } else if (motor.isTargetPositionReached()) {
+            reachedTime = micros();
+        }
+    }
+    datagrams = chip.getSpiDatagramCount() - datagrams;
+
+    if (!interrupt) {
+        printf("Wait polling : %u datagrams, reached %ld us after the predicted arrival\n", (unsigned)datagrams,
+               (long)(reachedTime - predictor.getArrivalTime()));
+        return;
+    }
+
+    printf("Wait on DIAG0 : %u datagrams, interrupt %ld us after the predicted arrival\n", (unsigned)datagrams,
+           (long)(events.getLastInterruptTime() - predictor.getArrivalTime()));
+
+    // A stall on DIAG1 needs no read to be identified
+    RAMP_STAT_Register rampStat;
+    rampStat.bytes = chip.peekRegister(ADDRESS_RAMP_STAT);
+    rampStat.status_sg = true;
+    chip.pokeRegister(ADDRESS_RAMP_STAT, rampStat.bytes);
+    datagrams = chip.getSpiDatagramCount();
+    events.dispatch();
+    printf("Stall on DIAG1 : %u callback, %u datagrams\n", stalls, (unsigned)(chip.getSpiDatagramCount() - datagrams));
+}
+
+static void uartDemo()
+{
+    TMC5160_EmulatedSerial line(115200);
+    TMC5160_Emulator chip;
+    line.attach(chip);
+
+    TMC5160_UART motor(line);
+    motor.setBaudRate(line.getBaudRate());
+    motor.setCommunicationMode(TMC5160_UART_Generic::RELIABLE_MODE);
+
+    uint64_t startTime = hostMicros();
+    bool ok = motor.begin();
+
+    printf("UART begin %s, %u datagrams, IFCNT %u, %llu us\n", ok ? "ok" : "FAILED",
+           (unsigned)chip.getUartDatagramCount(), (unsigned)chip.peekRegister(ADDRESS_IFCNT),
+           (unsigned long long)(hostMicros() - startTime));
+
+    // Lost datagrams and corrupted replies are recovered in reliable mode
+    motor.resetCommunicationSuccessRate();
+    chip.dropDatagrams(1);
+    chip.corruptReplies(1);
+    TMC5160_UART_Generic::ReadStatus status;
+    motor.writeRegister(ADDRESS_XTARGET, 1000, &status);
+
+    printf("UART XTARGET %u (status %d), read success %.2f, write success %.2f\n",
+           (unsigned)chip.peekRegister(ADDRESS_XTARGET), status, motor.getReadSuccessRate(),
+           motor.getWriteSuccessRate());
+}
+
+int main()
+{
+    spiDemo();
+    motionDemo();
+    queueDemo();
+    gantryRun(false);
+    gantryRun(true);
+    eventsRun(false);
+    eventsRun(true);
+    uartDemo();
+    return 0;
+}
@@ -0,0 +1,179 @@
+/* Minimal Arduino core for host (Linux / macOS) builds of the library.
+ *
+ * Time is virtual : it only moves forward through delay(), delayMicroseconds(), bus transfers
+ * (SPI.h, TMC5160_EmulatedSerial) and hostAdvanceMicros(). Each call to micros() or millis()
+ * also advances it by 1 us, so that busy-wait loops polling the clock terminate.
+ * hostSetRealTime(true) adds the elapsed wall clock time instead, to time code on the host.
+ *
+ * Serial prints to stdout.
+ */
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+template <class T, class L> auto min(const T &a, const L &b) -> decltype((b < a) ? b : a)
+{
+    return (b < a) ? b : a;
+}
+
+template <class T, class L> auto max(const T &a, const L &b) -> decltype((b < a) ? b : a)
+{
+    return (a < b) ? b : a;
+}
+
+/* Time */
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+inline void yield() {}
+
+uint64_t hostMicros();                 // Current virtual time, without advancing it
+void hostAdvanceMicros(uint32_t us);
+void hostSetRealTime(bool realTime);
+
+/* Pins. Handlers may watch digitalWrite() on a pin (emulated chip selects), several per pin. */
+typedef void (*HostPinHandler)(void *context, uint8_t pin, uint8_t value);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+bool hostAddPinHandler(uint8_t pin, HostPinHandler handler, void *context);
+void hostRemovePinHandler(uint8_t pin, HostPinHandler handler, void *context);
+void hostSetPinInput(uint8_t pin, uint8_t value);  // Level returned by digitalRead()
+
+/* Interrupts : attachInterrupt() handlers are called by hostSetPinInput() on matching edges */
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+void attachInterrupt(int interrupt, void (*handler)(), int mode);
+void detachInterrupt(int interrupt);
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+/* Just enough of String for message building */
+class String
+{
+  public:
+    String(const char *str = "") : _str(str != nullptr ? str : "") {}
+    String(char c) : _str(1, c) {}
+    String(int value, unsigned char base = DEC) : _str(_format((long)value, base)) {}
+    String(unsigned int value, unsigned char base = DEC) : _str(_format((unsigned long)value, base)) {}
+    String(long value, unsigned char base = DEC) : _str(_format(value, base)) {}
+    String(unsigned long value, unsigned char base = DEC) : _str(_format(value, base)) {}
+    String(double value, unsigned char decimals = 2);
+
+    const char *c_str() const { return _str.c_str(); }
+    unsigned int length() const { return (unsigned int)_str.length(); }
+
+    String &operator+=(const String &other) { _str += other._str; return *this; }
+    friend String operator+(String left, const String &right) { return left += right; }
+
+  private:
+    std::string _str;
+
+    static std::string _format(long value, unsigned char base);
+    static std::string _format(unsigned long value, unsigned char base);
+};
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t byte) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return str == nullptr ? 0 : write((const uint8_t *)str, strlen(str)); }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write(str.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(long long value, int base = DEC);
+    size_t print(unsigned long long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <class T> size_t println(T value) { return print(value) + println(); }
+    template <class T> size_t println(T value, int format) { return print(value, format) + println(); }
+};
+
+class Stream : public Print
+{
+  public:
+    Stream() : _timeout(1000) {}
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }  // ms
+    size_t readBytes(uint8_t *buffer, size_t length);
+    size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+
+  protected:
+    unsigned long _timeout;
+};
+
+/* The host console */
+class HardwareSerial : public Stream
+{
+  public:
+    void begin(unsigned long) {}
+    void end() {}
+    operator bool() const { return true; }
+
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    void flush();
+};
+
+extern HardwareSerial Serial;
+
+#endif // HOST_ARDUINO_H
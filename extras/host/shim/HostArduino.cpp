@@ -0,0 +1,362 @@
+#include "Arduino.h"
+#include "SPI.h"
+
+#include <stdio.h>
+
+#include <chrono>
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+/* Time */
+
+static uint64_t _hostMicros = 0;  // Virtual part
+static bool _realTime = false;
+static std::chrono::steady_clock::time_point _realTimeStart;
+
+uint64_t hostMicros()
+{
+    if (!_realTime)
+        return _hostMicros;
+
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - _realTimeStart;
+    return _hostMicros + std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+void hostAdvanceMicros(uint32_t us)
+{
+    _hostMicros += us;
+}
+
+void hostSetRealTime(bool realTime)
+{
+    if (realTime && !_realTime)
+        _realTimeStart = std::chrono::steady_clock::now();
+    else if (!realTime && _realTime)
+        _hostMicros = hostMicros();
+
+    _realTime = realTime;
+}
+
+unsigned long micros()
+{
+    if (_realTime)
+        return (unsigned long)hostMicros();
+
+    return (unsigned long)(_hostMicros++);
+}
+
+unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    _hostMicros += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    _hostMicros += us;
+}
+
+/* Pins */
+
+static constexpr uint8_t HOST_PIN_COUNT = 64;
+static constexpr uint8_t HOST_PIN_HANDLERS = 32;
+
+struct HostPin {
+    uint8_t output;
+    uint8_t input;
+    void (*isr)();
+    int isrMode;
+};
+
+struct HostPinWatch {
+    uint8_t pin;
+    HostPinHandler handler;
+    void *context;
+};
+
+static HostPin _pins[HOST_PIN_COUNT];
+static HostPinWatch _watches[HOST_PIN_HANDLERS];
+static uint8_t _watchCount = 0;
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    if (pin >= HOST_PIN_COUNT)
+        return;
+
+    _pins[pin].output = value;
+    for (uint8_t i = 0; i < _watchCount; i++) {
+        if (_watches[i].pin == pin)
+            _watches[i].handler(_watches[i].context, pin, value);
+    }
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pin < HOST_PIN_COUNT ? _pins[pin].input : LOW;
+}
+
+bool hostAddPinHandler(uint8_t pin, HostPinHandler handler, void *context)
+{
+    if (_watchCount >= HOST_PIN_HANDLERS)
+        return false;
+
+    _watches[_watchCount].pin = pin;
+    _watches[_watchCount].handler = handler;
+    _watches[_watchCount].context = context;
+    _watchCount++;
+    return true;
+}
+
+void hostRemovePinHandler(uint8_t pin, HostPinHandler handler, void *context)
+{
+    for (uint8_t i = 0; i < _watchCount; i++) {
+        HostPinWatch &watch = _watches[i];
+        if (watch.pin == pin && watch.handler == handler && watch.context == context) {
+            for (uint8_t j = i + 1; j < _watchCount; j++)
+                _watches[j - 1] = _watches[j];
+            _watchCount--;
+            return;
+        }
+    }
+}
+
+void hostSetPinInput(uint8_t pin, uint8_t value)
+{
+    if (pin >= HOST_PIN_COUNT)
+        return;
+
+    HostPin &hostPin = _pins[pin];
+    uint8_t previous = hostPin.input;
+    hostPin.input = value;
+
+    if (hostPin.isr == nullptr || previous == value)
+        return;
+
+    if (hostPin.isrMode == CHANGE || (hostPin.isrMode == RISING && value == HIGH) ||
+        (hostPin.isrMode == FALLING && value == LOW))
+        hostPin.isr();
+}
+
+void attachInterrupt(int interrupt, void (*handler)(), int mode)
+{
+    if (interrupt < 0 || interrupt >= HOST_PIN_COUNT)
+        return;
+
+    _pins[interrupt].isr = handler;
+    _pins[interrupt].isrMode = mode;
+}
+
+void detachInterrupt(int interrupt)
+{
+    if (interrupt >= 0 && interrupt < HOST_PIN_COUNT)
+        _pins[interrupt].isr = nullptr;
+}
+
+/* Random numbers */
+
+long random(long max)
+{
+    return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+    return min < max ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed)
+{
+    srand((unsigned int)seed);
+}
+
+/* String */
+
+String::String(double value, unsigned char decimals)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    _str = buffer;
+}
+
+std::string String::_format(long value, unsigned char base)
+{
+    if (base == DEC && value < 0)
+        return "-" + _format((unsigned long)(-value), base);
+
+    return _format((unsigned long)value, base);
+}
+
+std::string String::_format(unsigned long value, unsigned char base)
+{
+    if (base < 2)
+        base = 10;
+
+    std::string str;
+    do {
+        uint8_t digit = value % base;
+        value /= base;
+        str.insert(str.begin(), (char)(digit < 10 ? '0' + digit : 'A' + digit - 10));
+    } while (value != 0);
+
+    return str;
+}
+
+/* Print / Stream */
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+    while (size-- > 0)
+        written += write(*buffer++);
+    return written;
+}
+
+size_t Print::print(long value, int base)
+{
+    if (base == DEC)
+        return print((long long)value, base);
+
+    return print((unsigned long)value, base);  // Two's complement, like Arduino
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+    return print((unsigned long long)value, base);
+}
+
+size_t Print::print(long long value, int base)
+{
+    if (base == DEC && value < 0)
+        return print('-') + print((unsigned long long)(-value), base);
+
+    return print((unsigned long long)value, base);
+}
+
+size_t Print::print(unsigned long long value, int base)
+{
+    char buffer[8 * sizeof(value) + 1];
+    char *str = &buffer[sizeof(buffer) - 1];
+    *str = '\0';
+
+    if (base < 2)
+        base = 10;
+
+    do {
+        uint8_t digit = value % base;
+        value /= base;
+        *--str = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    } while (value != 0);
+
+    return write(str);
+}
+
+size_t Print::print(double value, int digits)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return write(buffer);
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+    size_t count = 0;
+    unsigned long startTime = millis();
+
+    while (count < length && millis() - startTime < _timeout) {
+        int c = read();
+        if (c >= 0)
+            buffer[count++] = (uint8_t)c;
+    }
+
+    return count;
+}
+
+size_t HardwareSerial::write(uint8_t byte)
+{
+    return fwrite(&byte, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush()
+{
+    fflush(stdout);
+}
+
+/* SPI */
+
+void SPIClass::beginTransaction(const SPISettings &settings)
+{
+    _clock = settings.getClockFreq();
+    _inTransaction = true;
+}
+
+bool SPIClass::attach(HostSPIDevice &device)
+{
+    if (_deviceCount >= MAX_DEVICES)
+        return false;
+
+    _devices[_deviceCount++] = &device;
+    return true;
+}
+
+void SPIClass::detach(HostSPIDevice &device)
+{
+    for (uint8_t i = 0; i < _deviceCount; i++) {
+        if (_devices[i] == &device) {
+            for (uint8_t j = i + 1; j < _deviceCount; j++)
+                _devices[j - 1] = _devices[j];
+            _deviceCount--;
+            return;
+        }
+    }
+}
+
+uint8_t SPIClass::_shift(uint8_t mosi)
+{
+    // 8 clock periods per byte
+    _nanosRemainder += 8000000000ULL / (_clock != 0 ? _clock : 1);
+    _hostMicros += _nanosRemainder / 1000;
+    _nanosRemainder %= 1000;
+
+    uint8_t data = mosi;
+    bool selected = false;
+    for (uint8_t i = 0; i < _deviceCount; i++) {
+        if (_devices[i]->spiSelected()) {
+            data = _devices[i]->spiTransfer(data);
+            selected = true;
+        }
+    }
+
+    return selected ? data : 0xFF;  // MISO floats high without a selected slave
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+    return _shift(data);
+}
+
+uint16_t SPIClass::transfer16(uint16_t data)
+{
+    uint16_t high = _shift(data >> 8);
+    return (high << 8) | _shift(data & 0xFF);
+}
+
+void SPIClass::transfer(void *buffer, size_t count)
+{
+    uint8_t *data = static_cast<uint8_t *>(buffer);
+    for (size_t i = 0; i < count; i++)
+        data[i] = _shift(data[i]);
+}
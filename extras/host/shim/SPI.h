@@ -0,0 +1,75 @@
+/* Minimal Arduino SPI library for host builds.
+ *
+ * Bytes are shifted through the attached devices which are currently selected, in attach order :
+ * the first one receives MOSI, the last one drives MISO. Several devices selected together thus
+ * behave as a daisy chain. Transfers advance the virtual clock at the configured SPI clock.
+ */
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+class SPISettings
+{
+  public:
+    SPISettings(uint32_t clock = 4000000, uint8_t bitOrder = MSBFIRST, uint8_t dataMode = SPI_MODE0)
+        : _clock(clock), _bitOrder(bitOrder), _dataMode(dataMode)
+    {
+    }
+
+    uint32_t getClockFreq() const { return _clock; }
+
+  private:
+    uint32_t _clock;
+    uint8_t _bitOrder;
+    uint8_t _dataMode;
+};
+
+/* An emulated SPI slave */
+class HostSPIDevice
+{
+  public:
+    virtual ~HostSPIDevice() {}
+
+    virtual bool spiSelected() const = 0;
+    virtual uint8_t spiTransfer(uint8_t mosi) = 0;  // Returns the byte shifted out
+};
+
+class SPIClass
+{
+  public:
+    static constexpr uint8_t MAX_DEVICES = 16;
+
+    SPIClass() : _deviceCount(0), _clock(4000000), _nanosRemainder(0), _inTransaction(false) {}
+
+    void begin() {}
+    void end() {}
+    void beginTransaction(const SPISettings &settings);
+    void endTransaction() { _inTransaction = false; }
+
+    uint8_t transfer(uint8_t data);
+    uint16_t transfer16(uint16_t data);
+    void transfer(void *buffer, size_t count);
+
+    bool attach(HostSPIDevice &device);
+    void detach(HostSPIDevice &device);
+    bool isInTransaction() const { return _inTransaction; }
+
+  private:
+    HostSPIDevice *_devices[MAX_DEVICES];
+    uint8_t _deviceCount;
+    uint32_t _clock;
+    uint64_t _nanosRemainder;
+    bool _inTransaction;
+
+    uint8_t _shift(uint8_t mosi);
+};
+
+extern SPIClass SPI;
+
+#endif // HOST_SPI_H
@@ -0,0 +1,25 @@
+#include "Arduino.h"
+
+#include <stdio.h>
+
+void setup();
+void loop();
+
+/* Runs an Arduino sketch on the host : setup(), then loop() SKETCH_LOOPS times (default 1).
+ * HOST_REAL_TIME=1 makes micros() / millis() follow the wall clock, for benchmark sketches. */
+int main()
+{
+    const char *realTime = getenv("HOST_REAL_TIME");
+    if (realTime != nullptr && atoi(realTime) != 0)
+        hostSetRealTime(true);
+
+    const char *loops = getenv("SKETCH_LOOPS");
+    long count = loops != nullptr ? atol(loops) : 1;
+
+    setup();
+    for (long i = 0; i < count; i++)
+        loop();
+
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,1017 @@
+/* Host checks of the library against the emulated TMC5160.
+ *
+ *   tmc5160_test
+ *
+ * Prints the failed checks and a summary ; the exit status is the number of failures, so
+ * make test fails when one of them does.
+ */
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "TMC5160.h"
+#include "TMC5160T.h"
+#include "TMC5160_Coordinator.h"
+#include "TMC5160_Emulator.h"
+#include "TMC5160_Events.h"
+#include "TMC5160_MoveQueue.h"
+#include "TMC5160_RampPredictor.h"
+
+static const uint8_t CS_PIN = 10;
+
+static unsigned checks;
+static unsigned failures;
+
+static void check(bool condition, int line, const char *format, ...)
+{
+    checks++;
+    if (condition)
+        return;
+
+    failures++;
+    printf("FAIL line %d : ", line);
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+#define CHECK(condition) check((condition), __LINE__, "%s", #condition)
+#define CHECK_MSG(condition, ...) check((condition), __LINE__, __VA_ARGS__)
+
+/* Emulator */
+
+// Reference values computed with the datasheet algorithm (bit serial, LSB first)
+static void testCrc()
+{
+    const uint8_t readRequest[] = { 0x05, 0x00, 0x00 };
+    const uint8_t readXactual[] = { 0x05, 0x00, 0x21 };
+    const uint8_t writeXtarget[] = { 0x05, 0x00, 0xA1, 0x00, 0x00, 0x12, 0x34 };
+    const uint8_t reply[] = { 0x05, 0xFF, 0x21, 0xFF, 0xFF, 0xFF, 0xFF };
+
+    CHECK(TMC5160_UART_Generic::crc8(readRequest, sizeof(readRequest)) == 0x48);
+    CHECK(TMC5160_UART_Generic::crc8(readXactual, sizeof(readXactual)) == 0xDD);
+    CHECK(TMC5160_UART_Generic::crc8(writeXtarget, sizeof(writeXtarget)) == 0x66);
+    CHECK(TMC5160_UART_Generic::crc8(reply, sizeof(reply)) == 0x42);
+}
+
+// The library access table against the register map of the emulator, over SPI
+static void testRegisterAccess()
+{
+    for (uint8_t address = 0; address < REGISTER_ADDRESS_COUNT; address++) {
+        TMC5160_Emulator chip(CS_PIN);
+        chip.attach(SPI);
+        TMC5160_SPI motor(CS_PIN);
+
+        uint8_t access = TMC5160::getRegisterAccess(address);
+
+        if (address == ADDRESS_VACTUAL)
+            chip.pokeRegister(ADDRESS_RAMPMODE, HOLD_MODE);  // Keeps the velocity
+        chip.pokeRegister(address, 0x00A5A5A0);
+        motor.readRegister(address);
+        bool readable = motor.readRegister(ADDRESS_GCONF) != 0;  // Non readable registers read as 0
+        CHECK_MSG(readable == ((access & REG_READ) != 0), "register 0x%02X read access", address);
+
+        bool writable;
+        if (address == ADDRESS_IO_INPUT_OUTPUT) {
+            motor.writeRegister(address, 0x01);
+            writable = chip.getOutput() == 0x01;
+        } else if (access & REG_CLEAR) {
+            // GSTAT drv_err, RAMP_STAT event_stop_sg, ENC_STATUS deviation_warn
+            uint32_t flag = address == ADDRESS_RAMP_STAT ? 0x40 : 0x02;
+            chip.pokeRegister(address, flag);
+            motor.writeRegister(address, flag);
+            writable = (chip.peekRegister(address) & flag) == 0;
+        } else {
+            chip.pokeRegister(address, 0);
+            motor.writeRegister(address, 0x00000002);
+            writable = chip.peekRegister(address) == 0x00000002;
+        }
+        CHECK_MSG(writable == ((access & REG_WRITE) != 0), "register 0x%02X write access", address);
+    }
+}
+
+// Replies carry the data of the previous datagram
+static void testSpiPipeline()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+
+    motor.writeRegister(ADDRESS_GCONF, 0x0C);
+    CHECK(motor.readRegister(ADDRESS_XTARGET) == 0x0C);  // Data of the write
+    motor.writeRegister(ADDRESS_XTARGET, 1234);
+    CHECK(motor.readRegister(ADDRESS_XTARGET) == 1234);
+    CHECK(motor.readRegister(ADDRESS_GCONF) == 1234);
+    CHECK(motor.lastSpiStatus().reset_flag);  // GSTAT.reset until cleared
+    CHECK(chip.getSpiDatagramCount() == 5);
+}
+
+// Dropped datagrams and corrupted replies are recovered in reliable mode
+static void testUartReliable()
+{
+    TMC5160_EmulatedSerial line(115200);
+    TMC5160_Emulator chip;
+    line.attach(chip);
+
+    TMC5160_UART motor(line);
+    motor.setBaudRate(line.getBaudRate());
+    motor.setCommunicationMode(TMC5160_UART_Generic::RELIABLE_MODE);
+    CHECK(motor.begin());
+
+    uint32_t ifcnt = chip.peekRegister(ADDRESS_IFCNT);
+    chip.dropDatagrams(1);
+    chip.corruptReplies(1);
+    TMC5160_UART_Generic::ReadStatus status;
+    motor.writeRegister(ADDRESS_XTARGET, 1000, &status);
+    CHECK(status == TMC5160_UART_Generic::SUCCESS);
+    CHECK(chip.peekRegister(ADDRESS_XTARGET) == 1000);
+    CHECK(chip.peekRegister(ADDRESS_IFCNT) == ((ifcnt + 1) & 0xFF));
+
+    chip.corruptReplies(1);
+    CHECK(motor.readRegister(ADDRESS_XTARGET, &status) == 1000);
+    CHECK(status == TMC5160_UART_Generic::SUCCESS);
+}
+
+// An async write is counted by IFCNT : the next reliable write still verifies at once
+static void testUartAsyncThenReliable()
+{
+    TMC5160_EmulatedSerial line(115200);
+    TMC5160_Emulator chip;
+    line.attach(chip);
+
+    TMC5160_UART motor(line);
+    motor.setBaudRate(line.getBaudRate());
+    motor.setCommunicationMode(TMC5160_UART_Generic::RELIABLE_MODE);
+    CHECK(motor.begin());
+
+    uint32_t ifcnt = chip.peekRegister(ADDRESS_IFCNT);
+    motor.resetCommunicationSuccessRate();
+    CHECK(motor.submitWrite(ADDRESS_XTARGET, 500));
+    motor.poll();
+    CHECK(motor.isAsyncIdle());
+
+    uint32_t datagrams = chip.getUartDatagramCount();
+    TMC5160_UART_Generic::ReadStatus status;
+    motor.writeRegister(ADDRESS_VMAX, 1000, &status);
+    CHECK(status == TMC5160_UART_Generic::SUCCESS);
+    CHECK_MSG(chip.getUartDatagramCount() - datagrams == 2, "%u datagrams for the reliable write",
+              (unsigned)(chip.getUartDatagramCount() - datagrams));  // Write and IFCNT read, no retry
+    CHECK(motor.getWriteSuccessRate() == 1.0f);
+    CHECK(chip.peekRegister(ADDRESS_IFCNT) == ((ifcnt + 2) & 0xFF));
+    CHECK(chip.peekRegister(ADDRESS_XTARGET) == 500 && chip.peekRegister(ADDRESS_VMAX) == 1000);
+}
+
+// Verified bursts : a lost write in the middle is found by bisection, a clean burst costs one check
+static void testUartVerifiedBurst()
+{
+    const uint8_t addresses[4] = { ADDRESS_XTARGET, ADDRESS_VMAX, ADDRESS_AMAX, ADDRESS_DMAX };
+    const uint32_t data[4] = { 1234, 5000, 300, 400 };
+
+    TMC5160_EmulatedSerial line(115200);
+    TMC5160_Emulator chip;
+    line.attach(chip);
+
+    TMC5160_UART motor(line);
+    motor.setBaudRate(line.getBaudRate());
+    motor.setCommunicationMode(TMC5160_UART_Generic::RELIABLE_MODE);
+    CHECK(motor.begin());
+
+    CHECK(motor.submitWrite(ADDRESS_VSTART, 10));  // Counted by IFCNT too
+    motor.poll();
+
+    uint32_t datagrams = chip.getUartDatagramCount();
+    TMC5160_UART_Generic::ReadStatus status;
+    motor.writeRegisters(addresses, data, 4, &status);
+    CHECK(status == TMC5160_UART_Generic::SUCCESS);
+    CHECK_MSG(chip.getUartDatagramCount() - datagrams == 5, "%u datagrams for a clean burst",
+              (unsigned)(chip.getUartDatagramCount() - datagrams));  // 4 writes, 1 IFCNT read
+
+    const uint32_t other[4] = { 4321, 6000, 500, 600 };
+    chip.dropDatagrams(1, 2);  // The third write
+    datagrams = chip.getUartDatagramCount();
+    motor.writeRegisters(addresses, other, 4, &status);
+    CHECK(status == TMC5160_UART_Generic::SUCCESS);
+    for (uint8_t i = 0; i < 4; i++)
+        CHECK_MSG(chip.peekRegister(addresses[i]) == other[i], "register 0x%02X", addresses[i]);
+    // 3 writes and a read, then each half resent : 2 writes and a read
+    CHECK_MSG(chip.getUartDatagramCount() - datagrams == 10, "%u datagrams for the bisected burst",
+              (unsigned)(chip.getUartDatagramCount() - datagrams));
+}
+
+// Adaptive mode : reliable while replies fail, back to streaming after a clean window
+static void testUartAdaptive()
+{
+    TMC5160_EmulatedSerial line(115200);
+    TMC5160_Emulator chip;
+    line.attach(chip);
+
+    TMC5160_UART motor(line);
+    motor.setBaudRate(line.getBaudRate());
+    CHECK(motor.begin());
+    motor.setCommunicationMode(TMC5160_UART_Generic::ADAPTIVE_MODE);
+    motor.setAdaptiveThresholds(4, 1);
+
+    for (uint8_t i = 0; i < 40; i++)
+        motor.readRegister(ADDRESS_XACTUAL);
+    CHECK(motor.getEffectiveCommunicationMode() == TMC5160_UART_Generic::STREAMING_MODE);
+    CHECK(motor.getModeTransitions() == 0);
+
+    chip.corruptReplies(4);
+    for (uint8_t i = 0; i < 4; i++)
+        motor.readRegister(ADDRESS_XACTUAL);
+    motor.readRegister(ADDRESS_XACTUAL);  // Switches before the access
+    CHECK(motor.getEffectiveCommunicationMode() == TMC5160_UART_Generic::RELIABLE_MODE);
+    CHECK(motor.getModeTransitions() == 1);
+
+    // Clean line, async and verified writes mixed : no false failure keeps it reliable
+    TMC5160_UART_Generic::ReadStatus status;
+    for (uint8_t i = 0; i < 40 && motor.getEffectiveCommunicationMode() == TMC5160_UART_Generic::RELIABLE_MODE; i++) {
+        motor.submitWrite(ADDRESS_XTARGET, i);
+        motor.poll();
+        motor.writeRegister(ADDRESS_VMAX, 1000 + i, &status);
+        CHECK(status == TMC5160_UART_Generic::SUCCESS);
+    }
+    CHECK(motor.getEffectiveCommunicationMode() == TMC5160_UART_Generic::STREAMING_MODE);
+    CHECK(motor.getModeTransitions() == 2);
+    CHECK(motor.getCommunicationMode() == TMC5160_UART_Generic::ADAPTIVE_MODE);
+}
+
+// A Batch holds the UART writes until the outermost scope ends, then sends them back to back
+static void testBatch()
+{
+    TMC5160_EmulatedSerial line(115200);
+    TMC5160_Emulator chip;
+    line.attach(chip);
+
+    TMC5160_UART motor(line);
+    motor.setBaudRate(line.getBaudRate());
+    CHECK(motor.begin());  // Streaming mode
+
+    // Without a batch, each write waits for the inter-frame gap
+    uint64_t startTime = hostMicros();
+    for (uint32_t i = 0; i < 4; i++)
+        motor.writeRegister(ADDRESS_XTARGET, i);
+    uint64_t unbatched = hostMicros() - startTime;
+
+    uint32_t ifcnt = chip.peekRegister(ADDRESS_IFCNT);
+    uint64_t batched;
+    {
+        TMC5160::Batch outer(motor);
+        motor.writeRegister(ADDRESS_VMAX, 1000);
+        {
+            TMC5160::Batch inner(motor);
+            motor.writeRegister(ADDRESS_AMAX, 200);
+            motor.writeRegister(ADDRESS_DMAX, 300);
+        }
+        CHECK(motor.isBatching());
+        CHECK(chip.peekRegister(ADDRESS_IFCNT) == ifcnt);  // Deferred past the inner scope
+        CHECK(chip.peekRegister(ADDRESS_VMAX) != 1000);
+        motor.writeRegister(ADDRESS_XTARGET, 5000);
+
+        startTime = hostMicros();
+    }
+    batched = hostMicros() - startTime;
+
+    CHECK(!motor.isBatching());
+    CHECK(chip.peekRegister(ADDRESS_IFCNT) == ((ifcnt + 4) & 0xFF));
+    CHECK(chip.peekRegister(ADDRESS_VMAX) == 1000 && chip.peekRegister(ADDRESS_AMAX) == 200);
+    CHECK(chip.peekRegister(ADDRESS_DMAX) == 300 && chip.peekRegister(ADDRESS_XTARGET) == 5000);
+
+    // One burst : 4 datagrams of 8 bytes, 10 bit times each, a single inter-frame gap before them
+    uint64_t burst = line.bitsToMicros(4 * 8 * 10);
+    uint64_t gap = motor.getInterFrameGap();
+    CHECK_MSG(batched <= burst + gap + 1 && unbatched >= burst + 3 * gap, "burst of %llu us, %llu us unbatched",
+              (unsigned long long)batched, (unsigned long long)unbatched);
+
+    // A read inside a batch sees the writes before it
+    {
+        TMC5160::Batch batch(motor);
+        motor.writeRegister(ADDRESS_GCONF, 0x0C);
+        CHECK(motor.readRegister(ADDRESS_GCONF) == 0x0C);
+    }
+
+    // flush() writes the dirty shadows as one batch
+    motor.setShadowRegister(ADDRESS_VSTART, 7);
+    motor.setShadowRegister(ADDRESS_VSTOP, 9);
+    CHECK(chip.peekRegister(ADDRESS_VSTART) != 7);
+    motor.flush();
+    CHECK(chip.peekRegister(ADDRESS_VSTART) == 7 && chip.peekRegister(ADDRESS_VSTOP) == 9);
+    CHECK(!motor.isShadowDirty(ADDRESS_VSTART) && !motor.isShadowDirty(ADDRESS_VSTOP));
+}
+
+struct UartTiming
+{
+    unsigned long gap;      // Measured between back to back writes, us
+    unsigned long reply;    // Read, request to reply
+    unsigned long timeout;  // Read without reply
+};
+
+static UartTiming uartTimingRun(uint32_t baudRate)
+{
+    TMC5160_EmulatedSerial line(baudRate);
+    TMC5160_Emulator chip;
+    line.attach(chip);
+
+    TMC5160_UART motor(line);
+    motor.setBaudRate(baudRate);
+    UartTiming timing;
+
+    // 4 writes : 4 datagrams, each after an inter-frame gap
+    uint64_t startTime = hostMicros();
+    for (uint32_t i = 1; i <= 4; i++)
+        motor.writeRegister(ADDRESS_XTARGET, i);
+    timing.gap = (unsigned long)((hostMicros() - startTime - line.bitsToMicros(4 * 80)) / 4);
+    CHECK(chip.peekRegister(ADDRESS_XTARGET) == 4);
+
+    TMC5160_UART_Generic::ReadStatus status;
+    delay(10);
+    startTime = hostMicros();
+    CHECK(motor.readRegister(ADDRESS_XTARGET, &status) == 4 && status == TMC5160_UART_Generic::SUCCESS);
+    timing.reply = (unsigned long)(hostMicros() - startTime);
+
+    delay(10);
+    chip.dropDatagrams(1);
+    startTime = hostMicros();
+    motor.readRegister(ADDRESS_XTARGET, &status);
+    CHECK(status == TMC5160_UART_Generic::NO_REPLY);
+    timing.timeout = (unsigned long)(hostMicros() - startTime);
+
+    CHECK_MSG(timing.gap + 1 >= line.bitsToMicros(12) && timing.gap <= motor.getInterFrameGap() + 2,
+              "%lu baud : gap of %lu us", (unsigned long)baudRate, timing.gap);
+    CHECK_MSG(timing.reply < motor.getReplyTimeout(), "%lu baud : reply after %lu us, timeout %lu us",
+              (unsigned long)baudRate, timing.reply, motor.getReplyTimeout());
+    CHECK_MSG(timing.timeout >= motor.getReplyTimeout() && timing.timeout < motor.getReplyTimeout() + line.bitsToMicros(80),
+              "%lu baud : gave up after %lu us, timeout %lu us", (unsigned long)baudRate, timing.timeout,
+              motor.getReplyTimeout());
+    return timing;
+}
+
+// The inter-frame gap and the reply timeout follow the bit time, in virtual time
+static void testUartTiming()
+{
+    UartTiming fast = uartTimingRun(115200);
+    UartTiming slow = uartTimingRun(9600);
+
+    // 12x the bit time : the gap scales, the timeout too but for its fixed slack
+    CHECK_MSG(slow.gap >= 11 * fast.gap && slow.gap <= 13 * fast.gap, "gaps %lu / %lu us", slow.gap, fast.gap);
+    CHECK_MSG(slow.timeout >= 8 * fast.timeout, "timeouts %lu / %lu us", slow.timeout, fast.timeout);
+}
+
+struct BusRead
+{
+    uint8_t *order;
+    uint8_t *count;
+    uint8_t slave;
+    uint32_t data;
+    TMC5160_UART_Generic::ReadStatus status;
+};
+
+static void onBusRead(void *context, uint32_t data, TMC5160_UART_Generic::ReadStatus status)
+{
+    BusRead &read = *(BusRead *)context;
+    read.data = data;
+    read.status = status;
+    read.order[(*read.count)++] = read.slave;
+}
+
+// Two slaves on one line : reads served in turn, each reply to the driver that asked
+static void testUartBus()
+{
+    TMC5160_EmulatedSerial line(115200);
+    TMC5160_Emulator chip0, chip1;
+    chip1.setNAI(true);  // Address 1
+    line.attach(chip0);
+    line.attach(chip1);
+
+    TMC5160_UART motor0(line, 0), motor1(line, 1);
+    motor0.setBaudRate(line.getBaudRate());
+    motor1.setBaudRate(line.getBaudRate());
+
+    TMC5160_UART_Bus bus;
+    CHECK(bus.attach(motor0) && bus.attach(motor1));
+    chip0.pokeRegister(ADDRESS_XACTUAL, 111);
+    chip1.pokeRegister(ADDRESS_XACTUAL, 222);
+
+    // Every request of slave 0 queued first
+    uint8_t order[6];
+    uint8_t count = 0;
+    BusRead reads[6];
+    for (uint8_t i = 0; i < 6; i++) {
+        reads[i] = { order, &count, (uint8_t)(i / 3), 0, TMC5160_UART_Generic::NO_REPLY };
+        TMC5160_UART &motor = i < 3 ? motor0 : motor1;
+        CHECK(motor.submitRead(ADDRESS_XACTUAL, onBusRead, &reads[i]));
+    }
+    CHECK(motor1.submitWrite(ADDRESS_XTARGET, 500));
+
+    for (uint32_t i = 0; i < 100000 && count < 6; i++)
+        bus.poll();
+
+    CHECK(count == 6);
+    for (uint8_t i = 0; i < count; i++)
+        CHECK_MSG(order[i] == i % 2, "read %u from slave %u", i, order[i]);  // Round-robin
+    for (uint8_t i = 0; i < 6; i++) {
+        CHECK(reads[i].status == TMC5160_UART_Generic::SUCCESS);
+        CHECK_MSG(reads[i].data == (i < 3 ? 111u : 222u), "read %u : %lu", i, (unsigned long)reads[i].data);
+    }
+
+    CHECK(chip1.peekRegister(ADDRESS_XTARGET) == 500 && chip0.peekRegister(ADDRESS_XTARGET) == 0);
+    CHECK(bus.getStatistics(0).reads == 3 && bus.getStatistics(1).reads == 3);
+    CHECK(bus.getStatistics(1).writes == 1 && bus.getStatistics(0).errors == 0 && bus.getStatistics(1).errors == 0);
+    CHECK(bus.isIdle());
+}
+
+/* Library */
+
+/* Async SPI : a backend that completes each transfer when told, like a DMA interrupt */
+class DeferredBackend : public TMC5160_SPI_Backend
+{
+  public:
+    explicit DeferredBackend(uint8_t chipSelectPin) : _pin(chipSelectPin), _buffer(nullptr) {}
+
+    void startTransfer(uint8_t *buffer, size_t length, CompletionHandler handler, void *context)
+    {
+        _buffer = buffer;
+        _length = length;
+        _handler = handler;
+        _context = context;
+    }
+
+    bool complete()
+    {
+        if (_buffer == nullptr)
+            return false;
+
+        uint8_t *buffer = _buffer;
+        _buffer = nullptr;
+        digitalWrite(_pin, LOW);
+        SPI.transfer(buffer, _length);
+        digitalWrite(_pin, HIGH);
+        _handler(_context);
+        return true;
+    }
+
+  private:
+    uint8_t _pin;
+    uint8_t *_buffer;
+    size_t _length;
+    CompletionHandler _handler;
+    void *_context;
+};
+
+struct AsyncLog
+{
+    uint8_t count;
+    uint8_t tags[8];
+    uint32_t data[8];
+};
+
+struct AsyncTag
+{
+    AsyncLog *log;
+    uint8_t tag;
+};
+
+static void logAsync(void *context, uint32_t data, SPI_STATUS_Register)
+{
+    AsyncTag &tag = *(AsyncTag *)context;
+    AsyncLog &log = *tag.log;
+    if (log.count < 8) {
+        log.tags[log.count] = tag.tag;
+        log.data[log.count] = data;
+        log.count++;
+    }
+}
+
+// Queued transactions complete in order, each callback with the data of the previous datagram
+static void asyncSpiRun(bool deferred)
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+
+    DeferredBackend backend(CS_PIN);
+    if (deferred)
+        motor.setBackend(&backend);
+
+    chip.pokeRegister(ADDRESS_VMAX, 0);
+    AsyncLog log = {};
+    AsyncTag tags[4] = { { &log, 0 }, { &log, 1 }, { &log, 2 }, { &log, 3 } };
+    CHECK(motor.submitWrite(ADDRESS_XTARGET, 111, logAsync, &tags[0]));
+    CHECK(motor.submitRead(ADDRESS_XTARGET, logAsync, &tags[1]));
+    CHECK(motor.submitWrite(ADDRESS_VMAX, 222, logAsync, &tags[2]));
+    CHECK(motor.submitRead(ADDRESS_GCONF, logAsync, &tags[3]));
+
+    if (deferred) {
+        CHECK(motor.getPendingTransactions() == 4);
+        CHECK(chip.peekRegister(ADDRESS_XTARGET) == 0);  // Nothing shifted yet
+
+        CHECK(backend.complete());
+        CHECK(log.count == 1 && chip.peekRegister(ADDRESS_XTARGET) == 111);
+        CHECK(chip.peekRegister(ADDRESS_VMAX) == 0);
+        while (backend.complete())
+            ;
+    }
+
+    CHECK(motor.isAsyncIdle());
+    CHECK(log.count == 4);
+    for (uint8_t i = 0; i < log.count; i++)
+        CHECK_MSG(log.tags[i] == i, "transaction %u completed at %u", log.tags[i], i);
+
+    CHECK(chip.peekRegister(ADDRESS_XTARGET) == 111);
+    CHECK(chip.peekRegister(ADDRESS_VMAX) == 222);
+    CHECK(log.data[1] == 111);                                     // Data of the XTARGET write
+    CHECK(log.data[2] == chip.peekRegister(ADDRESS_XTARGET));     // Read result, one datagram late
+    CHECK(log.data[3] == 222);                                     // Data of the VMAX write
+}
+
+static void testAsyncSpi()
+{
+    asyncSpiRun(false);
+    asyncSpiRun(true);
+}
+
+// Every writable register which is not R+WC has a shadow of its own
+static void testShadowRegisters()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();  // Clears GSTAT.reset : the SPI status reset_flag invalidates the shadow
+
+    uint8_t count = 0;
+    for (uint8_t address = 0; address < REGISTER_ADDRESS_COUNT; address++) {
+        uint8_t access = TMC5160::getRegisterAccess(address);
+        if ((access & REG_WRITE) && !(access & REG_CLEAR)) {
+            count++;
+            motor.writeRegister(address, 0x100 + address);
+        }
+    }
+    CHECK_MSG(count == TMC5160::SHADOW_REGISTER_COUNT, "%u shadowed registers, SHADOW_REGISTER_COUNT %u", count,
+              TMC5160::SHADOW_REGISTER_COUNT);
+
+    for (uint8_t address = 0; address < REGISTER_ADDRESS_COUNT; address++) {
+        uint8_t access = TMC5160::getRegisterAccess(address);
+        bool shadowed = (access & REG_WRITE) && !(access & REG_CLEAR);
+        CHECK_MSG(motor.isShadowValid(address) == shadowed, "register 0x%02X shadow", address);
+        if (shadowed)
+            CHECK_MSG(motor.getShadowRegister(address) == 0x100u + address, "register 0x%02X shadow value", address);
+    }
+
+    // Write-only registers read back what was written, without a bus access
+    uint32_t datagrams = chip.getSpiDatagramCount();
+    CHECK(motor.readShadowRegister(ADDRESS_VMAX) == 0x100u + ADDRESS_VMAX);
+    motor.writeRegister(ADDRESS_AMAX, 1234);
+    CHECK(motor.readShadowRegister(ADDRESS_AMAX) == 1234);
+    CHECK(chip.peekRegister(ADDRESS_AMAX) == 1234);
+    CHECK(chip.getSpiDatagramCount() - datagrams == 1);
+}
+
+// Redundant writes are skipped until a reset, which drops the shadow and is reported once
+static void testShadowReset()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+    CHECK(!motor.isResetOccurred());
+
+    motor.setRedundantWriteSuppression(true);
+    motor.resetWriteCounters();
+    uint32_t datagrams = chip.getSpiDatagramCount();
+    motor.writeRegister(ADDRESS_VMAX, 1000);
+    motor.writeRegister(ADDRESS_VMAX, 1000);
+    CHECK(motor.getIssuedWriteCount() == 1 && motor.getSkippedWriteCount() == 1);
+    CHECK(chip.getSpiDatagramCount() - datagrams == 1);
+
+    {
+        TMC5160::Batch batch(motor);
+        motor.setShadowRegister(ADDRESS_AMAX, 77);
+        CHECK(motor.isShadowDirty(ADDRESS_AMAX));
+
+        chip.pokeRegister(ADDRESS_GSTAT, 0x01);  // Reset : the next reply has reset_flag
+        motor.writeRegister(ADDRESS_VSTART, 5);
+        CHECK(!motor.isShadowDirty(ADDRESS_AMAX));  // Dropped with the configuration
+        CHECK(!motor.isShadowValid(ADDRESS_VMAX));
+    }
+    CHECK(chip.peekRegister(ADDRESS_AMAX) != 77);
+
+    motor.writeRegister(ADDRESS_VMAX, 1000);  // Unknown again : sent
+    CHECK(motor.getIssuedWriteCount() == 3 && motor.getSkippedWriteCount() == 1);
+
+    chip.pokeRegister(ADDRESS_GSTAT, 0);  // Cleared meanwhile : the reset stays latched
+    CHECK(motor.isResetOccurred());
+    CHECK(!motor.isResetOccurred());
+}
+
+// Exact reads, and failures told apart from a register holding -1
+static void testPositionAccessors()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+
+    motor.setCurrentPositionMicrosteps(5);
+    motor.readRegister(ADDRESS_GCONF);
+    CHECK(motor.getCurrentPositionMicrosteps() == 5);
+    CHECK(motor.getExtendedPosition() == 5);
+
+    chip.pokeRegister(ADDRESS_XACTUAL, 0xFFFFFFFF);
+    CHECK(motor.getCurrentPositionMicrosteps() == -1);
+    CHECK(motor.getExtendedPosition() == -1);
+
+    chip.pokeRegister(ADDRESS_XACTUAL, 0x80000000);  // Past the 32-bit wraparound, downwards
+    CHECK(motor.getExtendedPosition() == -1 - 0x7FFFFFFFLL);
+
+    TMC5160_EmulatedSerial line(115200);
+    TMC5160_Emulator uartChip;
+    line.attach(uartChip);
+    TMC5160_UART uart(line);
+    uart.setBaudRate(line.getBaudRate());
+    uart.begin();
+
+    uart.setCurrentPositionMicrosteps(7);
+    CHECK(uart.getExtendedPosition() == 7);
+    uartChip.pokeRegister(ADDRESS_XACTUAL, 9);
+    uartChip.corruptReplies(10);  // Every retry fails
+    CHECK(uart.getExtendedPosition() == 7);
+    uartChip.corruptReplies(0);
+    CHECK(uart.getExtendedPosition() == 9);
+}
+
+// A positioning move ends on the target, when the ramp model says
+static void testRamp()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+
+    motor.setRampMode(POSITIONING_MODE);
+    motor.setAccelerations(800, 800, 800, 800);
+    motor.moveAtVelocity(400);
+    motor.setTargetPosition(400);
+
+    TMC5160_RampPredictor predictor;
+    CHECK(predictor.loadParameters(motor));
+    CHECK(predictor.plan(0, 400 * 256));
+
+    chip.runUntilSettled();
+    RAMP_STAT_Register rampStat;
+    rampStat.bytes = chip.peekRegister(ADDRESS_RAMP_STAT);
+    CHECK((int32_t)chip.peekRegister(ADDRESS_XACTUAL) == 400 * 256);
+    CHECK(rampStat.position_reached && rampStat.event_pos_reached);
+    CHECK(chip.peekRegister(ADDRESS_VACTUAL) == 0);
+
+    // Arrival within 1 ms of the model (settling includes TZEROWAIT, 0 here)
+    long error = (long)(hostMicros() - predictor.getArrivalTime());
+    CHECK_MSG(labs(error) < 1000, "arrival %ld us off the predicted one", error);
+}
+
+// Past 2^24 microsteps, the model still follows the chip to a few microsteps
+static void testLongRamp()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+
+    motor.setRampMode(POSITIONING_MODE);
+    motor.setAccelerationRaw(2000);
+    motor.writeRegister(ADDRESS_DMAX, 2000);
+    motor.writeRegister(ADDRESS_D_1, 2000);
+    motor.moveAtVelocityRaw(2000000);
+    motor.setTargetPositionMicrosteps(0x70000000);
+
+    TMC5160_RampPredictor predictor;
+    CHECK(predictor.loadParameters(motor));
+    CHECK(predictor.plan(0, 0x70000000, micros()));
+
+    for (uint8_t i = 0; i < 5; i++) {
+        delay(240000);
+        unsigned long time = micros();
+        int32_t error = predictor.getPosition(time) - (int32_t)chip.peekRegister(ADDRESS_XACTUAL);
+        CHECK_MSG(labs(error) <= 8, "position %ld microsteps off the chip at %lu us", (long)error, time);
+    }
+}
+
+// A blended move waits for the braking towards the previous target, not a slowdown to a lower VMAX
+static void testMoveQueue()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+
+    motor.setRampMode(POSITIONING_MODE);
+    motor.setAccelerations(4000, 4000, 4000, 4000);  // Braking from 400 steps / s : 20 steps
+    motor.moveAtVelocity(400);
+    uint32_t vmax = motor.getShadowRegister(ADDRESS_VMAX);
+
+    TMC5160_MoveQueue queue(motor);
+    CHECK(queue.add(100 * 256));
+    CHECK(queue.add(200 * 256, vmax / 4, 0, 0, true));
+    CHECK(queue.add(300 * 256, vmax, 0, 0, true));
+
+    int32_t startPositions[3];
+    uint8_t started = 0;
+    for (uint32_t ms = 0; ms < 10000 && queue.isRunning(); ms++) {
+        if (queue.service() && started < 3)
+            startPositions[started++] = (int32_t)chip.peekRegister(ADDRESS_XACTUAL);
+        delay(1);
+    }
+
+    CHECK(started == 3);
+    if (started == 3) {
+        // Blended into the second move while braking towards 100 steps, into the third one only
+        // once braking towards 200 steps (from VMAX / 4 : 1.25 steps), not during the slowdown
+        CHECK_MSG(startPositions[1] > 75 * 256 && startPositions[1] < 100 * 256, "second move at %ld",
+                  (long)startPositions[1]);
+        CHECK_MSG(startPositions[2] > 197 * 256 && startPositions[2] < 200 * 256, "third move at %ld",
+                  (long)startPositions[2]);
+    }
+    CHECK((int32_t)chip.peekRegister(ADDRESS_XACTUAL) == 300 * 256);
+    CHECK(chip.peekRegister(ADDRESS_VMAX) == vmax);
+}
+
+// The microstep resolution of TMC5160T survives disable() / enable()
+static void testMicrostepResolution()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160T<12000000, 16, TMC5160_SPI> motor(CS_PIN);
+    motor.begin();
+
+    CHOPCONF_Register chopConf;
+    chopConf.bytes = chip.peekRegister(ADDRESS_CHOPCONF);
+    CHECK(chopConf.mres == 4);
+
+    motor.disable();
+    chopConf.bytes = chip.peekRegister(ADDRESS_CHOPCONF);
+    CHECK(chopConf.mres == 4 && chopConf.toff == 0);
+
+    motor.enable();
+    chopConf.bytes = chip.peekRegister(ADDRESS_CHOPCONF);
+    CHECK(chopConf.mres == 4);
+
+    TMC5160_SPI plain(CS_PIN);  // 256 microsteps
+    plain.begin();
+    chopConf.bytes = chip.peekRegister(ADDRESS_CHOPCONF);
+    CHECK(chopConf.mres == 0);
+}
+
+// Accelerations and ramp speeds saturate to their register width, the same in TMC5160T
+static const uint8_t RAMP_REGISTERS[7] = { ADDRESS_AMAX, ADDRESS_DMAX, ADDRESS_A_1, ADDRESS_D_1, ADDRESS_VSTART,
+                                           ADDRESS_VSTOP, ADDRESS_V_1 };
+static const uint32_t RAMP_LIMITS[7] = { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0x3FFFF, 0x3FFFF, 0xFFFFF };
+
+// Called on the driver type itself : the TMC5160T functions are not virtual
+template <class Driver>
+static void conversionLimitsRun(Driver &motor, TMC5160_Emulator &chip, const char *name)
+{
+    motor.setAccelerations(1e6, 1e6, 1e6, 1e6);
+    motor.setRampSpeeds(1e5, 1e5, 1e5);
+    for (uint8_t r = 0; r < 7; r++)
+        CHECK_MSG(chip.peekRegister(RAMP_REGISTERS[r]) == RAMP_LIMITS[r], "%s register 0x%02X : 0x%lX", name,
+                  RAMP_REGISTERS[r], (unsigned long)chip.peekRegister(RAMP_REGISTERS[r]));
+
+    motor.setAccelerations(1000, 800, 1200, 600);
+    motor.setRampSpeeds(10, 5, 200);
+}
+
+static void testConversionLimits()
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    TMC5160_Emulator chipT(CS_PIN + 1);
+    chipT.attach(SPI);
+    TMC5160_SPI motor(CS_PIN);
+    TMC5160T<DEFAULT_F_CLK, 256, TMC5160_SPI> motorT(CS_PIN + 1);
+
+    conversionLimitsRun(motor, chip, "TMC5160");
+    conversionLimitsRun(motorT, chipT, "TMC5160T");
+
+    // Moderate values : converted the same by both
+    for (uint8_t r = 0; r < 7; r++)
+        CHECK_MSG(chip.peekRegister(RAMP_REGISTERS[r]) == chipT.peekRegister(RAMP_REGISTERS[r])
+                      && chip.peekRegister(RAMP_REGISTERS[r]) < RAMP_LIMITS[r],
+                  "register 0x%02X : 0x%lX, TMC5160T 0x%lX", RAMP_REGISTERS[r],
+                  (unsigned long)chip.peekRegister(RAMP_REGISTERS[r]), (unsigned long)chipT.peekRegister(RAMP_REGISTERS[r]));
+}
+
+/* Coordinator */
+
+static TMC5160_RampPredictor::Parameters coordinatorPath(TMC5160 &axis)
+{
+    TMC5160_RampPredictor::Parameters path = {};
+    path.amax = path.dmax = path.a1 = path.d1 = axis.getShadowRegister(ADDRESS_AMAX);
+    path.vmax = axis.getShadowRegister(ADDRESS_VMAX);
+    path.vstop = 10;
+    return path;
+}
+
+// XY diagonal of 300 x 100 steps : the axes stay on the straight line and arrive together
+static void testCoordinatorLine()
+{
+    const int32_t targets[2] = { 300 * 256, 100 * 256 };
+
+    TMC5160_Emulator chipX(CS_PIN), chipY(CS_PIN + 1);
+    chipX.attach(SPI);
+    chipY.attach(SPI);
+    TMC5160_Emulator *chips[2] = { &chipX, &chipY };
+
+    TMC5160_SPI axisX(CS_PIN), axisY(CS_PIN + 1);
+    TMC5160_SPI *axes[2] = { &axisX, &axisY };
+    TMC5160_Coordinator coordinator;
+
+    for (uint8_t i = 0; i < 2; i++) {
+        axes[i]->begin();
+        axes[i]->setRampMode(POSITIONING_MODE);
+        axes[i]->setAccelerations(800, 800, 800, 800);
+        axes[i]->moveAtVelocity(400);
+        CHECK(coordinator.addAxis(*axes[i]));
+    }
+
+    coordinator.setPathParameters(coordinatorPath(axisX));
+    CHECK(coordinator.moveTo(targets));
+
+    uint64_t startTime = hostMicros();
+    uint64_t arrival[2] = { 0, 0 };
+    double deviation = 0;
+
+    while ((arrival[0] == 0 || arrival[1] == 0) && hostMicros() - startTime < 10000000) {
+        hostAdvanceMicros(100);
+
+        double position[2];
+        for (uint8_t i = 0; i < 2; i++) {
+            position[i] = (int32_t)chips[i]->peekRegister(ADDRESS_XACTUAL);
+            if (arrival[i] == 0 && position[i] == targets[i])
+                arrival[i] = hostMicros() - startTime;
+        }
+
+        // Distance to the line from the origin to the targets
+        double distance = fabs(position[0] * targets[1] - position[1] * targets[0]) / hypot(targets[0], targets[1]);
+        deviation = distance > deviation ? distance : deviation;
+    }
+
+    // Independent ramps : about 12000 microsteps and 540 ms
+    CHECK(arrival[0] != 0 && arrival[1] != 0);
+    CHECK_MSG(deviation <= 4, "off the line by %.1f microsteps", deviation);
+    long skew = (long)(arrival[0] - arrival[1]);
+    CHECK_MSG(labs(skew) <= 1000, "arrivals %ld us apart", skew);
+}
+
+/* Chip select rising edges that changed the XTARGET of the chained chips */
+struct TargetWatch
+{
+    TMC5160_Emulator *chips[2];
+    uint32_t targets[2];
+    unsigned transactions;  // Changing at least one XTARGET
+    unsigned together;      // Changing both
+};
+
+static void watchTargets(void *context, uint8_t, uint8_t value)
+{
+    TargetWatch &watch = *(TargetWatch *)context;
+    if (value != HIGH)
+        return;
+
+    uint8_t changed = 0;
+    for (uint8_t i = 0; i < 2; i++) {
+        uint32_t target = watch.chips[i]->peekRegister(ADDRESS_XTARGET);
+        changed += target != watch.targets[i];
+        watch.targets[i] = target;
+    }
+    watch.transactions += changed != 0;
+    watch.together += changed == 2;
+}
+
+// With setChain(), the targets of a daisy chain are written by a single transaction
+static unsigned coordinatorChainRun(bool chained, unsigned *together)
+{
+    const int32_t targets[2] = { 300 * 256, 100 * 256 };
+
+    TMC5160_Emulator chip0(CS_PIN), chip1(CS_PIN);  // Chained, in attach order
+    chip0.attach(SPI);
+    chip1.attach(SPI);
+
+    TMC5160_SPI_Chain chain(CS_PIN, 2);
+    TMC5160_SPI_ChainDevice axis0(chain, 0), axis1(chain, 1);
+    TMC5160_SPI_ChainDevice *axes[2] = { &axis0, &axis1 };
+    TMC5160_Coordinator coordinator;
+
+    for (uint8_t i = 0; i < 2; i++) {
+        axes[i]->begin();
+        axes[i]->setRampMode(POSITIONING_MODE);
+        axes[i]->setAccelerations(800, 800, 800, 800);
+        axes[i]->moveAtVelocity(400);
+        coordinator.addAxis(*axes[i]);
+    }
+    if (chained)
+        coordinator.setChain(chain);
+    coordinator.setPathParameters(coordinatorPath(axis0));
+
+    // Added after the emulators : called once they latched the datagram
+    TargetWatch watch = { { &chip0, &chip1 }, { 0, 0 }, 0, 0 };
+    CHECK(hostAddPinHandler(CS_PIN, watchTargets, &watch));
+    CHECK(coordinator.moveTo(targets));
+    hostRemovePinHandler(CS_PIN, watchTargets, &watch);
+
+    CHECK((int32_t)chip0.peekRegister(ADDRESS_XTARGET) == targets[0]);
+    CHECK((int32_t)chip1.peekRegister(ADDRESS_XTARGET) == targets[1]);
+
+    *together = watch.together;
+    return watch.transactions;
+}
+
+static void testCoordinatorChain()
+{
+    unsigned together;
+    unsigned transactions = coordinatorChainRun(true, &together);
+    CHECK_MSG(transactions == 1 && together == 1, "targets written by %u transactions, %u for both", transactions,
+              together);
+
+    transactions = coordinatorChainRun(false, &together);  // One transaction per axis
+    CHECK_MSG(transactions == 2 && together == 0, "targets written by %u transactions, %u for both", transactions,
+              together);
+}
+
+/* Events */
+
+static const uint8_t DIAG0_PIN = 2;
+static const uint8_t DIAG1_PIN = 3;
+
+static void countCallback(TMC5160 &, void *context)
+{
+    (*(unsigned *)context)++;
+}
+
+// One stall callback per stall, whether DIAG0 or DIAG1 reports it
+static unsigned stallRun(bool diag1)
+{
+    TMC5160_Emulator chip(CS_PIN);
+    chip.attach(SPI);
+    chip.setDiagPins(DIAG0_PIN, DIAG1_PIN);
+    TMC5160_SPI motor(CS_PIN);
+    motor.begin();
+
+    unsigned stalls = 0;
+    TMC5160_Events events(motor);
+    events.onStall(countCallback, &stalls);
+    CHECK(events.begin(DIAG0_PIN, diag1 ? DIAG1_PIN : TMC5160_Events::NO_PIN));
+
+    // Stall while moving : status_sg, and event_stop_sg latched by sg_stop
+    RAMP_STAT_Register rampStat;
+    rampStat.bytes = chip.peekRegister(ADDRESS_RAMP_STAT);
+    rampStat.status_sg = true;
+    rampStat.event_stop_sg = true;
+    chip.pokeRegister(ADDRESS_RAMP_STAT, rampStat.bytes);
+
+    for (uint8_t i = 0; i < 4; i++)
+        events.dispatch();
+
+    events.end();
+    return stalls;
+}
+
+static void testEventsStall()
+{
+    unsigned stalls = stallRun(true);
+    CHECK_MSG(stalls == 1, "%u stall callbacks with DIAG1", stalls);
+    stalls = stallRun(false);
+    CHECK_MSG(stalls == 1, "%u stall callbacks on DIAG0", stalls);
+}
+
+int main()
+{
+    testCrc();
+    testRegisterAccess();
+    testSpiPipeline();
+    testUartReliable();
+    testUartAsyncThenReliable();
+    testUartVerifiedBurst();
+    testUartAdaptive();
+    testBatch();
+    testUartBus();
+    testUartTiming();
+    testAsyncSpi();
+    testShadowRegisters();
+    testShadowReset();
+    testPositionAccessors();
+    testRamp();
+    testLongRamp();
+    testMoveQueue();
+    testMicrostepResolution();
+    testConversionLimits();
+    testCoordinatorLine();
+    testCoordinatorChain();
+    testEventsStall();
+
+    printf("%u checks, %u failed\n", checks, failures);
+    return failures > 255 ? 255 : failures;
+}
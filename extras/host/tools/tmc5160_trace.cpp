@@ -0,0 +1,381 @@
+/* Decodes and replays the bus traces dumped by TMC5160_Trace::dump().
+ *
+ *   tmc5160_trace decode <dump>            list the records and summarize the bus usage
+ *   tmc5160_trace compare <before> <after> bus usage of two traces side by side
+ *   tmc5160_trace replay <dump>            send the same datagrams to an emulated chip, at the
+ *                                          recorded times, and report the replies that differ
+ *   tmc5160_trace record <dump> [spi|uart] trace a short session against the emulated chip
+ *                                          (library built with -DTMC5160_ENABLE_TRACE)
+ *
+ * The replay runs in virtual time : it is deterministic, and an access never starts before its
+ * recorded offset from the first record (later if the previous ones took longer). The emulated
+ * chip starts from its power-on state, so a trace that does not start at begin() may differ on
+ * the registers configured before.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "TMC5160.h"
+#include "TMC5160_Emulator.h"
+
+static const uint8_t CS_PIN = 10;
+static const uint32_t DEFAULT_BAUD_RATE = 115200;
+static const unsigned MAX_REPORTED_MISMATCHES = 10;
+
+struct Dump {
+    uint8_t transport;
+    uint8_t node;
+    uint32_t baudRate;
+    uint32_t total;
+    std::vector<TMC5160_TraceRecord> records;
+};
+
+struct Usage {
+    unsigned reads;
+    unsigned writes;
+    unsigned errors;  // UART reads without a valid reply
+    uint64_t span;    // us from the first datagram to the end of the last one
+    uint64_t busTime; // us spent in transfers
+};
+
+static uint32_t readLittleEndian(const uint8_t *bytes, uint8_t length)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < length; i++)
+        value |= (uint32_t)bytes[i] << (8 * i);
+    return value;
+}
+
+static bool loadDump(const char *path, Dump &dump)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+
+    std::vector<uint8_t> bytes;
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        bytes.insert(bytes.end(), buffer, buffer + length);
+    fclose(file);
+
+    const uint8_t *header = bytes.data();
+    if (bytes.size() < TMC5160_Trace::DUMP_HEADER_LENGTH ||
+        readLittleEndian(header, 4) != TMC5160_Trace::DUMP_MAGIC) {
+        fprintf(stderr, "%s: not a TMC5160 trace\n", path);
+        return false;
+    }
+
+    uint8_t recordLength = header[7];
+    if (header[4] != TMC5160_Trace::DUMP_VERSION || recordLength < TMC5160_Trace::RECORD_LENGTH) {
+        fprintf(stderr, "%s: unsupported trace version %u\n", path, header[4]);
+        return false;
+    }
+
+    dump.transport = header[5];
+    dump.node = header[6];
+    dump.baudRate = readLittleEndian(header + 8, 4);
+    dump.total = readLittleEndian(header + 12, 4);
+    uint16_t count = readLittleEndian(header + 16, 2);
+
+    if (bytes.size() < TMC5160_Trace::DUMP_HEADER_LENGTH + (size_t)count * recordLength) {
+        fprintf(stderr, "%s: truncated, %u records expected\n", path, count);
+        return false;
+    }
+
+    dump.records.resize(count);
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t *record = header + TMC5160_Trace::DUMP_HEADER_LENGTH + i * recordLength;
+        dump.records[i].timestamp = readLittleEndian(record, 4);
+        dump.records[i].data = readLittleEndian(record + 4, 4);
+        dump.records[i].address = record[8];
+        dump.records[i].status = record[9];
+        dump.records[i].duration = readLittleEndian(record + 10, 2);
+    }
+
+    return true;
+}
+
+static const char *transportName(uint8_t transport)
+{
+    switch (transport) {
+    case TMC5160_Trace::TRANSPORT_SPI: return "SPI";
+    case TMC5160_Trace::TRANSPORT_SPI_CHAIN: return "SPI chain";
+    case TMC5160_Trace::TRANSPORT_UART: return "UART";
+    default: return "unknown";
+    }
+}
+
+static const char *uartStatusName(uint8_t status)
+{
+    switch (status) {
+    case TMC5160_UART_Generic::SUCCESS: return "ok";
+    case TMC5160_UART_Generic::NO_REPLY: return "no reply";
+    case TMC5160_UART_Generic::INVALID_FORMAT: return "invalid format";
+    case TMC5160_UART_Generic::BAD_CRC: return "bad crc";
+    default: return "?";
+    }
+}
+
+static bool isWrite(const TMC5160_TraceRecord &record)
+{
+    return record.address & 0x80;
+}
+
+static Usage usage(const Dump &dump)
+{
+    Usage usage = { 0, 0, 0, 0, 0 };
+
+    for (const TMC5160_TraceRecord &record : dump.records) {
+        if (isWrite(record))
+            usage.writes++;
+        else
+            usage.reads++;
+
+        if (dump.transport == TMC5160_Trace::TRANSPORT_UART && record.status != TMC5160_UART_Generic::SUCCESS)
+            usage.errors++;
+
+        usage.busTime += record.duration;
+    }
+
+    if (!dump.records.empty()) {
+        const TMC5160_TraceRecord &last = dump.records.back();
+        usage.span = (uint32_t)(last.timestamp - dump.records.front().timestamp) + last.duration;
+    }
+
+    return usage;
+}
+
+static void printUsage(const char *name, const Dump &dump)
+{
+    Usage u = usage(dump);
+    printf("%s: %s, %zu records (%u traced), %u reads, %u writes, %u errors, span %llu us, bus %llu us (%.1f %%)\n",
+           name, transportName(dump.transport), dump.records.size(), (unsigned)dump.total, u.reads, u.writes,
+           u.errors, (unsigned long long)u.span, (unsigned long long)u.busTime,
+           u.span != 0 ? 100.0 * u.busTime / u.span : 0.0);
+}
+
+static int decode(const char *path)
+{
+    Dump dump;
+    if (!loadDump(path, dump))
+        return 1;
+
+    printf("# %s, node %u", transportName(dump.transport), dump.node);
+    if (dump.baudRate != 0)
+        printf(", %u baud", (unsigned)dump.baudRate);
+    if (dump.total > dump.records.size())
+        printf(", %u oldest records overwritten", (unsigned)(dump.total - dump.records.size()));
+    printf("\n#   time_us  delta_us  dir  addr  data        status   duration_us\n");
+
+    uint32_t previous = dump.records.empty() ? 0 : dump.records.front().timestamp;
+    for (const TMC5160_TraceRecord &record : dump.records) {
+        printf("%11u %9u  %s  0x%02X  0x%08X  ", (unsigned)record.timestamp, (unsigned)(record.timestamp - previous),
+               isWrite(record) ? "W" : "R", record.address & 0x7F, (unsigned)record.data);
+
+        if (dump.transport == TMC5160_Trace::TRANSPORT_UART)
+            printf("%-8s", uartStatusName(record.status));
+        else
+            printf("0x%02X    ", record.status);
+
+        printf(" %u\n", record.duration);
+        previous = record.timestamp;
+    }
+
+    printUsage(path, dump);
+    return 0;
+}
+
+static int compare(const char *before, const char *after)
+{
+    Dump dumps[2];
+    if (!loadDump(before, dumps[0]) || !loadDump(after, dumps[1]))
+        return 1;
+
+    printUsage(before, dumps[0]);
+    printUsage(after, dumps[1]);
+
+    Usage u0 = usage(dumps[0]), u1 = usage(dumps[1]);
+    unsigned accesses0 = u0.reads + u0.writes, accesses1 = u1.reads + u1.writes;
+    if (accesses0 != 0 && accesses1 != 0)
+        printf("bus us per datagram: %.1f -> %.1f\n", (double)u0.busTime / accesses0, (double)u1.busTime / accesses1);
+
+    return 0;
+}
+
+/* Replay */
+
+static int replay(const char *path)
+{
+    Dump dump;
+    if (!loadDump(path, dump))
+        return 1;
+
+    bool uart = dump.transport == TMC5160_Trace::TRANSPORT_UART;
+    uint32_t baudRate = dump.baudRate != 0 ? dump.baudRate : DEFAULT_BAUD_RATE;
+
+    TMC5160_EmulatedSerial line(baudRate);
+    TMC5160_Emulator chip(uart ? TMC5160_Emulator::NO_PIN : CS_PIN);
+    TMC5160_SPI spiMotor(CS_PIN);
+    TMC5160_UART uartMotor(line, dump.node);
+
+    if (uart) {
+        line.attach(chip);
+        chip.pokeRegister(ADDRESS_SLAVECONF, dump.node);
+        uartMotor.setBaudRate(baudRate);
+        uartMotor.setCommunicationMode(TMC5160_UART_Generic::STREAMING_MODE);  // One datagram per record
+    } else {
+        chip.attach(SPI);
+    }
+
+    if (dump.total > dump.records.size())
+        printf("note: the %u oldest records were overwritten, the chip state may differ\n",
+               (unsigned)(dump.total - dump.records.size()));
+
+    unsigned dataMismatches = 0, statusMismatches = 0;
+    uint64_t busTime = 0;
+    uint64_t start = hostMicros();
+    uint32_t firstTimestamp = dump.records.empty() ? 0 : dump.records.front().timestamp;
+
+    for (size_t i = 0; i < dump.records.size(); i++) {
+        const TMC5160_TraceRecord &record = dump.records[i];
+        uint8_t address = record.address & 0x7F;
+
+        uint64_t due = start + (uint32_t)(record.timestamp - firstTimestamp);
+        uint64_t now = hostMicros();
+        if (due > now)
+            hostAdvanceMicros((uint32_t)(due - now));
+
+        uint64_t accessStart = hostMicros();
+        uint32_t data = record.data;
+        uint8_t status;
+
+        if (uart) {
+            TMC5160_UART_Generic::ReadStatus readStatus = TMC5160_UART_Generic::SUCCESS;
+            if (isWrite(record))
+                uartMotor.writeRegister(address, record.data);
+            else
+                data = uartMotor.readRegister(address, &readStatus);
+            status = readStatus;
+        } else {
+            if (isWrite(record))
+                spiMotor.writeRegister(address, record.data);
+            else
+                data = spiMotor.readRegister(address);
+            status = spiMotor.lastSpiStatus().bytes;
+        }
+
+        busTime += hostMicros() - accessStart;
+
+        bool dataDiffers = data != record.data;
+        bool statusDiffers = status != record.status;
+        dataMismatches += dataDiffers;
+        statusMismatches += statusDiffers;
+
+        if ((dataDiffers || statusDiffers) && dataMismatches + statusMismatches <= MAX_REPORTED_MISMATCHES)
+            printf("record %zu %s 0x%02X: data 0x%08X / replay 0x%08X, status 0x%02X / replay 0x%02X\n", i,
+                   isWrite(record) ? "W" : "R", address, (unsigned)record.data, (unsigned)data, record.status, status);
+    }
+
+    Usage original = usage(dump);
+    uint64_t span = hostMicros() - start;
+    printf("replayed %zu records: %u data and %u status mismatches\n", dump.records.size(), dataMismatches,
+           statusMismatches);
+    printf("span %llu us (recorded %llu), bus %llu us (recorded %llu)\n", (unsigned long long)span,
+           (unsigned long long)original.span, (unsigned long long)busTime, (unsigned long long)original.busTime);
+
+    return dataMismatches + statusMismatches == 0 ? 0 : 2;
+}
+
+/* Sample traces */
+
+#ifdef TMC5160_ENABLE_TRACE
+class FilePrint : public Print
+{
+  public:
+    explicit FilePrint(FILE *file) : _file(file) {}
+    size_t write(uint8_t byte) { return fputc(byte, _file) == EOF ? 0 : 1; }
+    using Print::write;
+
+  private:
+    FILE *_file;
+};
+
+static void session(TMC5160 &motor)
+{
+    motor.begin();
+
+    motor.setRampMode(POSITIONING_MODE);
+    motor.setAccelerations(800, 800, 800, 800);
+    motor.moveAtVelocity(400);
+    motor.setTargetPosition(100);
+
+    for (int i = 0; i < 4; i++) {
+        delay(20);
+        motor.readRegister(ADDRESS_XACTUAL);
+        motor.readRegister(ADDRESS_VACTUAL);
+    }
+}
+
+static int record(const char *path, const char *transport)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "%s: cannot create\n", path);
+        return 1;
+    }
+
+    FilePrint out(file);
+
+    if (strcmp(transport, "uart") == 0) {
+        TMC5160_EmulatedSerial line(DEFAULT_BAUD_RATE);
+        TMC5160_Emulator chip;
+        line.attach(chip);
+
+        TMC5160_UART motor(line);
+        motor.setBaudRate(line.getBaudRate());
+        motor.setCommunicationMode(TMC5160_UART_Generic::RELIABLE_MODE);
+        chip.corruptReplies(1);  // Show a retry in the trace
+        session(motor);
+        motor.getTrace().dump(out);
+    } else {
+        TMC5160_Emulator chip(CS_PIN);
+        chip.attach(SPI);
+
+        TMC5160_SPI motor(CS_PIN);
+        session(motor);
+        motor.getTrace().dump(out);
+    }
+
+    fclose(file);
+    return 0;
+}
+#else
+static int record(const char *, const char *)
+{
+    fprintf(stderr, "record needs the library built with -DTMC5160_ENABLE_TRACE\n");
+    return 1;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    const char *command = argc > 1 ? argv[1] : "";
+
+    if (strcmp(command, "decode") == 0 && argc == 3)
+        return decode(argv[2]);
+    if (strcmp(command, "compare") == 0 && argc == 4)
+        return compare(argv[2], argv[3]);
+    if (strcmp(command, "replay") == 0 && argc == 3)
+        return replay(argv[2]);
+    if (strcmp(command, "record") == 0 && (argc == 3 || argc == 4))
+        return record(argv[2], argc == 4 ? argv[3] : "spi");
+
+    fprintf(stderr, "usage: %s decode <dump> | compare <before> <after> | replay <dump> | record <dump> [spi|uart]\n",
+            argv[0]);
+    return 1;
+}
@@ -2,8 +2,14 @@
 
 #include "TMC5160.h"
 
-TMC5160::TMC5160(uint32_t fclk) : _fclk(fclk)
+TMC5160::TMC5160(uint32_t fclk)
+: _fclk(fclk), _uSteps(_uStepCount), _currentRampMode(POSITIONING_MODE), _shadowValid(0), _shadowDirty(0), _batchDepth(0), _suppressRedundantWrites(false), _resetLatched(false), _skippedWriteCounter(0),
+  _issuedWriteCounter(0)
 {
+    TMC5160_STATS(_stats.reset());
+    setMicrostepsPerStep(_uSteps);  // Clock dependent units, CHOPCONF.mres
+
+    _extendedPosition = _extendedEncoderPosition = ExtendedPosition{0, 0, false};  // Reset value
 }
 
 TMC5160::~TMC5160()
@@ -11,10 +17,203 @@ TMC5160::~TMC5160()
     ;
 }
 
+void TMC5160::setClockFrequency(uint32_t fclk)
+{
+    _fclk = fclk;
+
+    _speedToHzScale = (float)fclk / (float)(1ul << 24) / (float)_uSteps;
+    _speedUnitHz = (float)fclk / (float)(1ul << 24);
+    _accelUnitHz = (float)fclk * (float)fclk / (512.0 * 256.0) / (float)(1ul << 24);
+
+    // Rounded fixed point : 2^48 / fclk, and 2^73 / fclk^2 in two steps to stay within 64 bits.
+    // Both fit 32 bits for any fclk above 1.5MHz.
+    _speedFactor = (uint32_t)(((1ull << 48) + fclk / 2) / fclk);
+    uint64_t accel = ((1ull << 62) + fclk / 2) / fclk;
+    _accelFactor = (uint32_t)(((accel << 11) + fclk / 2) / fclk);
+}
+
+void TMC5160::setMicrostepsPerStep(uint16_t uSteps)
+{
+    _uSteps = uSteps;
+    setClockFrequency(_fclk);
+
+    // mres 0 : 256 microsteps, each step up halves them. begin() writes it, so do disable() / enable().
+    chopConf.mres = 0;
+    for (uint16_t count = 256; count > _uSteps && chopConf.mres < 8; count >>= 1)
+        chopConf.mres++;
+}
+
+int32_t TMC5160::speedFromMicrosteps(int32_t microstepsPerSecond) const
+{
+    uint32_t magnitude = microstepsPerSecond < 0 ? -(uint32_t)microstepsPerSecond : (uint32_t)microstepsPerSecond;
+    uint64_t speed = ((uint64_t)magnitude * _speedFactor + (1ul << 23)) >> 24;
+
+    if (speed > 0x7FFFFFFF)
+        speed = 0x7FFFFFFF;
+
+    return microstepsPerSecond < 0 ? -(int32_t)speed : (int32_t)speed;
+}
+
+uint32_t TMC5160::accelFromMicrosteps(uint32_t microstepsPerSecond2) const
+{
+    return (uint32_t)(((uint64_t)microstepsPerSecond2 * _accelFactor + (1ul << 31)) >> 32);
+}
+
+#ifdef TMC5160_ENABLE_STATS
+void TMC5160_TransferStats::reset()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+uint8_t TMC5160_TransferStats::latencyBucket(unsigned long latency)
+{
+    uint8_t bucket = 0;
+    while (latency != 0 && bucket < LATENCY_BUCKETS - 1) {
+        latency >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void TMC5160_TransferStats::recordAccess(uint8_t address, bool write, unsigned long latency)
+{
+    address &= 0x7F;
+    if (address < REGISTER_ADDRESS_COUNT)
+        (write ? writes : reads)[address]++;
+
+    (write ? writeLatency : readLatency)[latencyBucket(latency)]++;
+}
+
+void TMC5160_TransferStats::print(Print &out) const
+{
+    out.print("bytes ");
+    out.print(bytesSent);
+    out.print(" ");
+    out.print(bytesReceived);
+    out.print(" retries ");
+    out.print(retries);
+    out.print(" bus_us ");
+    out.println(busTime);
+
+    for (uint8_t address = 0; address < REGISTER_ADDRESS_COUNT; address++) {
+        if (reads[address] != 0) {
+            out.print("r 0x");
+            out.print(address, HEX);
+            out.print(" ");
+            out.println(reads[address]);
+        }
+        if (writes[address] != 0) {
+            out.print("w 0x");
+            out.print(address, HEX);
+            out.print(" ");
+            out.println(writes[address]);
+        }
+    }
+
+    out.print("lat_r");
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        out.print(" ");
+        out.print(readLatency[i]);
+    }
+    out.println();
+
+    out.print("lat_w");
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        out.print(" ");
+        out.print(writeLatency[i]);
+    }
+    out.println();
+}
+#endif
+
+static_assert(sizeof(TMC5160_TraceRecord) == TMC5160_Trace::RECORD_LENGTH, "Trace records must stay packed");
+
+TMC5160_Trace::TMC5160_Trace() : _transport(TRANSPORT_SPI), _node(0), _baudRate(0)
+{
+    clear();
+}
+
+void TMC5160_Trace::setSource(Transport transport, uint8_t node, uint32_t baudRate)
+{
+    _transport = transport;
+    _node = node;
+    _baudRate = baudRate;
+}
+
+void TMC5160_Trace::clear()
+{
+    _head = 0;
+    _count = 0;
+    _total = 0;
+    _frozen = false;
+}
+
+const TMC5160_TraceRecord &TMC5160_Trace::getRecord(uint16_t index) const
+{
+    return _records[(_head + TMC5160_TRACE_LENGTH - _count + index) % TMC5160_TRACE_LENGTH];
+}
+
+void TMC5160_Trace::record(uint8_t address, uint32_t data, uint8_t status, unsigned long startTime)
+{
+    if (_frozen)
+        return;
+
+    unsigned long duration = micros() - startTime;
+
+    TMC5160_TraceRecord &record = _records[_head];
+    record.timestamp = startTime;
+    record.data = data;
+    record.address = address;
+    record.status = status;
+    record.duration = duration < 0xFFFF ? duration : 0xFFFF;
+
+    _head = (_head + 1) % TMC5160_TRACE_LENGTH;
+    if (_count < TMC5160_TRACE_LENGTH)
+        _count++;
+    _total++;
+}
+
+size_t TMC5160_Trace::_write(Print &out, uint32_t value, uint8_t length)
+{
+    uint8_t bytes[4];
+    for (uint8_t i = 0; i < length; i++)
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+
+    return out.write(bytes, length);
+}
+
+size_t TMC5160_Trace::dump(Print &out) const
+{
+    size_t written = _write(out, DUMP_MAGIC, 4);
+    written += _write(out, DUMP_VERSION, 1);
+    written += _write(out, _transport, 1);
+    written += _write(out, _node, 1);
+    written += _write(out, RECORD_LENGTH, 1);
+    written += _write(out, _baudRate, 4);
+    written += _write(out, _total, 4);
+    written += _write(out, _count, 2);
+    written += _write(out, 0, 2);
+
+    for (uint16_t i = 0; i < _count; i++) {
+        const TMC5160_TraceRecord &record = getRecord(i);
+        written += _write(out, record.timestamp, 4);
+        written += _write(out, record.data, 4);
+        written += _write(out, record.address, 1);
+        written += _write(out, record.status, 1);
+        written += _write(out, record.duration, 2);
+    }
+
+    return written;
+}
+
 bool TMC5160::begin()
 {
+    Batch batch(*this);
     bool retVal = false;
 
+    // The chip may have been reset : forget everything known about its registers
+    invalidateShadow();
+
     /* Clear the reset and charge pump undervoltage flags */
     globalStatus.reset = true;
     globalStatus.uv_cp = true;
@@ -51,7 +250,7 @@ bool TMC5160::begin()
     chopConf.tbl = 0;         ///< Comparator blank time select.
     chopConf.hstrt_tfd = 7;   ///< Hysteresis start value HSTRT, chm=1: fast decay time setting bits 0:2
     chopConf.hend_offset = 7; ///< Hysteresis end value HEND, chm=1: sine wave offset
-    chopConf.mres = 0;        ///< Set microstep resolution
+    // chopConf.mres : microstep resolution, set by setMicrostepsPerStep()
     chopConf.chm = 0;         ///< Chopper mode (0=standard - spreadCycle ; 1=constant off time with fast decay time)
     chopConf.tpfd = 0;        ///< Passive fast decay time
 
@@ -71,9 +270,225 @@ bool TMC5160::begin()
     // Set default start, stop, threshold speeds.
     setRampSpeeds(50, 0, 0); // Start, stop, threshold speeds */
 
+    _resetLatched = false;  // The reset begin() answers
     return (retVal);
 }
 
+uint8_t TMC5160::getRegisterAccess(uint8_t address)
+{
+    switch (address) {
+    case ADDRESS_GCONF:         return REG_ACCESS_RW;
+    case ADDRESS_GSTAT:         return REG_ACCESS_RWC;
+    case ADDRESS_IFCNT:         return REG_ACCESS_R;
+    case ADDRESS_SLAVECONF:     return REG_ACCESS_W;
+    case ADDRESS_IO_INPUT_OUTPUT: return REG_ACCESS_RW | REG_VOLATILE; // Reads IOIN, writes OUTPUT
+    case ADDRESS_X_COMPARE:     return REG_ACCESS_W;
+    case ADDRESS_OTP_PROG:      return REG_ACCESS_W;
+    case ADDRESS_OTP_READ:      return REG_ACCESS_R;
+    case ADDRESS_FACTORY_CONF:  return REG_ACCESS_RW;
+    case ADDRESS_SHORT_CONF:    return REG_ACCESS_W;
+    case ADDRESS_DRV_CONF:      return REG_ACCESS_W;
+    case ADDRESS_GLOBAL_SCALER: return REG_ACCESS_W;
+    case ADDRESS_OFFSET_READ:   return REG_ACCESS_R;
+
+    case ADDRESS_IHOLD_IRUN:    return REG_ACCESS_W;
+    case ADDRESS_TPOWERDOWN:    return REG_ACCESS_W;
+    case ADDRESS_TSTEP:         return REG_ACCESS_R;
+    case ADDRESS_TPWMTHRS:      return REG_ACCESS_W;
+    case ADDRESS_TCOOLTHRS:     return REG_ACCESS_W;
+    case ADDRESS_THIGH:         return REG_ACCESS_W;
+
+    case ADDRESS_RAMPMODE:      return REG_ACCESS_RW;
+    case ADDRESS_XACTUAL:       return REG_ACCESS_RW | REG_VOLATILE;
+    case ADDRESS_VACTUAL:       return REG_ACCESS_R;
+    case ADDRESS_VSTART:        return REG_ACCESS_W;
+    case ADDRESS_A_1:           return REG_ACCESS_W;
+    case ADDRESS_V_1:           return REG_ACCESS_W;
+    case ADDRESS_AMAX:          return REG_ACCESS_W;
+    case ADDRESS_VMAX:          return REG_ACCESS_W;
+    case ADDRESS_DMAX:          return REG_ACCESS_W;
+    case ADDRESS_D_1:           return REG_ACCESS_W;
+    case ADDRESS_VSTOP:         return REG_ACCESS_W;
+    case ADDRESS_TZEROWAIT:     return REG_ACCESS_W;
+    case ADDRESS_XTARGET:       return REG_ACCESS_RW;
+
+    case ADDRESS_VDCMIN:        return REG_ACCESS_W;
+    case ADDRESS_SW_MODE:       return REG_ACCESS_RW;
+    case ADDRESS_RAMP_STAT:     return REG_ACCESS_RWC;
+    case ADDRESS_XLATCH:        return REG_ACCESS_R;
+
+    case ADDRESS_ENCMODE:       return REG_ACCESS_RW;
+    case ADDRESS_X_ENC:         return REG_ACCESS_RW | REG_VOLATILE;
+    case ADDRESS_ENC_CONST:     return REG_ACCESS_W;
+    case ADDRESS_ENC_STATUS:    return REG_ACCESS_RWC;
+    case ADDRESS_ENC_LATCH:     return REG_ACCESS_R;
+    case ADDRESS_ENC_DEVIATION: return REG_ACCESS_W;
+
+    case ADDRESS_MSLUT_0_7 + 0: case ADDRESS_MSLUT_0_7 + 1:
+    case ADDRESS_MSLUT_0_7 + 2: case ADDRESS_MSLUT_0_7 + 3:
+    case ADDRESS_MSLUT_0_7 + 4: case ADDRESS_MSLUT_0_7 + 5:
+    case ADDRESS_MSLUT_0_7 + 6: case ADDRESS_MSLUT_0_7 + 7:
+                                return REG_ACCESS_W;
+    case ADDRESS_MSLUTSEL:      return REG_ACCESS_W;
+    case ADDRESS_MSLUTSTART:    return REG_ACCESS_W;
+    case ADDRESS_MSCNT:         return REG_ACCESS_R;
+    case ADDRESS_MSCURACT:      return REG_ACCESS_R;
+    case ADDRESS_CHOPCONF:      return REG_ACCESS_RW;
+    case ADDRESS_COOLCONF:      return REG_ACCESS_W;
+    case ADDRESS_DCCTRL:        return REG_ACCESS_W;
+    case ADDRESS_DRV_STATUS:    return REG_ACCESS_R;
+    case ADDRESS_PWMCONF:       return REG_ACCESS_W;
+    case ADDRESS_PWM_SCALE:     return REG_ACCESS_R;
+    case ADDRESS_PWM_AUTO:      return REG_ACCESS_R;
+    case ADDRESS_LOST_STEPS:    return REG_ACCESS_R;
+
+    default:                    return 0;
+    }
+}
+
+// Index in the shadow register file, -1 for registers that are not shadowed
+int8_t TMC5160::_shadowIndex(uint8_t address)
+{
+    static_assert(SHADOW_REGISTER_COUNT <= 64, "Shadow valid / dirty flags are 64-bit wide");
+
+    // Registers are stored in address order. The lookup table is shared by all instances and
+    // built on first use from the access flags.
+    static int8_t indexes[REGISTER_ADDRESS_COUNT];
+    static bool initialized = false;
+
+    // SHADOW_REGISTER_COUNT must match the access table : the host tests check it. A register
+    // past the count is left unshadowed rather than overflowing the shadow file.
+    if (!initialized) {
+        int8_t index = 0;
+        for (uint8_t a = 0; a < REGISTER_ADDRESS_COUNT; a++) {
+            uint8_t access = getRegisterAccess(a);
+            bool shadowed = (access & REG_WRITE) && !(access & REG_CLEAR) && index < SHADOW_REGISTER_COUNT;
+            indexes[a] = shadowed ? index++ : -1;
+        }
+        initialized = true;
+    }
+
+    return address < REGISTER_ADDRESS_COUNT ? indexes[address] : -1;
+}
+
+void TMC5160::_registerWritten(uint8_t address, uint32_t data)
+{
+    if (address == ADDRESS_XACTUAL)
+        _extendedPosition.written(data);
+    else if (address == ADDRESS_X_ENC)
+        _extendedEncoderPosition.written(data);
+
+    int8_t index = _shadowIndex(address);
+    if (index < 0)
+        return;
+
+    _shadow[index] = data;
+    _shadowValid |= (1ULL << index);
+    _shadowDirty &= ~(1ULL << index);
+}
+
+void TMC5160::_registerWriteFailed(uint8_t address)
+{
+    int8_t index = _shadowIndex(address);
+    if (index >= 0)
+        _shadowValid &= ~(1ULL << index);
+}
+
+bool TMC5160::_isRedundantWrite(uint8_t address, uint32_t data)
+{
+    if (_suppressRedundantWrites) {
+        int8_t index = _shadowIndex(address);
+
+        // Only a value known to be on the chip counts : not a dirty one, not one the chip may have changed
+        if (index >= 0 && (_shadowValid & (1ULL << index)) && !(_shadowDirty & (1ULL << index))
+            && !(getRegisterAccess(address) & REG_VOLATILE) && _shadow[index] == data) {
+            _skippedWriteCounter++;
+            return true;
+        }
+    }
+
+    _issuedWriteCounter++;
+    return false;
+}
+
+bool TMC5160::isShadowValid(uint8_t address)
+{
+    int8_t index = _shadowIndex(address);
+    return index >= 0 && (_shadowValid & (1ULL << index));
+}
+
+bool TMC5160::isShadowDirty(uint8_t address)
+{
+    int8_t index = _shadowIndex(address);
+    return index >= 0 && (_shadowDirty & (1ULL << index));
+}
+
+uint32_t TMC5160::getShadowRegister(uint8_t address)
+{
+    return isShadowValid(address) ? _shadow[_shadowIndex(address)] : 0;
+}
+
+uint32_t TMC5160::readShadowRegister(uint8_t address)
+{
+    int8_t index = _shadowIndex(address);
+    if (index < 0)
+        return _readRegisterExact(address);
+
+    uint8_t access = getRegisterAccess(address);
+    bool valid = _shadowValid & (1ULL << index);
+
+    // Volatile registers are changed by the chip (or read back something else) : the shadow only
+    // holds the last written value and is never refreshed from a read.
+    if (!valid && (access & REG_READ) && !(access & REG_VOLATILE)) {
+        _shadow[index] = _readRegisterExact(address);
+        _shadowValid |= (1ULL << index);
+        valid = true;
+    }
+
+    return valid ? _shadow[index] : 0;
+}
+
+void TMC5160::setShadowRegister(uint8_t address, uint32_t data)
+{
+    int8_t index = _shadowIndex(address);
+    if (index < 0)
+        return;
+
+    _shadow[index] = data;
+    _shadowValid |= (1ULL << index);
+    _shadowDirty |= (1ULL << index);
+}
+
+void TMC5160::flush()
+{
+    Batch batch(*this);
+
+    for (uint8_t address = 0; address < REGISTER_ADDRESS_COUNT && _shadowDirty; address++) {
+        int8_t index = _shadowIndex(address);
+        if (index >= 0 && (_shadowDirty & (1ULL << index)))
+            writeRegister(address, _shadow[index]); // Clears the dirty flag
+    }
+}
+
+void TMC5160::invalidateShadow()
+{
+    _shadowValid = 0;
+    _shadowDirty = 0;
+}
+
+void TMC5160::_resetDetected()
+{
+    invalidateShadow();
+    _resetLatched = true;
+}
+
+bool TMC5160::_takeResetLatch()
+{
+    bool latched = _resetLatched;
+    _resetLatched = false;
+    return latched;
+}
+
 void TMC5160::setRampMode(RampMode mode) {
     switch (mode) {
     case POSITIONING_MODE:
@@ -96,37 +511,37 @@ void TMC5160::setRampMode(RampMode mode) {
 float TMC5160::getCurrentPosition() {
     int32_t uStepPos = readRegister(ADDRESS_XACTUAL);
 
-    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uStepCount);
+    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uSteps);
 }
 
 float TMC5160::getEncoderPosition() {
     int32_t uStepPos = readRegister(ADDRESS_X_ENC);
 
-    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uStepCount);
+    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uSteps);
 }
 
 float TMC5160::getLatchedPosition() {
     int32_t uStepPos = readRegister(ADDRESS_XLATCH);
 
-    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uStepCount);
+    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uSteps);
 }
 
 float TMC5160::getLatchedEncoderPosition() {
     int32_t uStepPos = readRegister(ADDRESS_ENC_LATCH);
 
-    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uStepCount);
+    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uSteps);
 }
 
 float TMC5160::getTargetPosition() {
     int32_t uStepPos = readRegister(ADDRESS_XTARGET);
 
-    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uStepCount);
+    return (uStepPos == 0xFFFFFFFF) ? NAN : static_cast<float>(uStepPos) / static_cast<float>(_uSteps);
 }
 
 
 
 void TMC5160::invertDriver(bool invert) {
-    globalConfig.bytes = readRegister(ADDRESS_GCONF);
+    globalConfig.bytes = readShadowRegister(ADDRESS_GCONF);
 
     if (invert) {
         globalConfig.bytes |= (1 << 4);
@@ -155,49 +570,94 @@ float TMC5160::getCurrentSpeed()
 
 void TMC5160::setCurrentPosition(float position, bool updateEncoderPos)
 {
-    writeRegister(ADDRESS_XACTUAL, (int)(position * (float)_uStepCount));
+    Batch batch(*this);
+
+    writeRegister(ADDRESS_XACTUAL, (int)(position * (float)_uSteps));
 
     if (updateEncoderPos)
     {
-        writeRegister(ADDRESS_X_ENC, (int)(position * (float)_uStepCount));
+        writeRegister(ADDRESS_X_ENC, (int)(position * (float)_uSteps));
         clearEncoderDeviationFlag();
     }
 }
 
 void TMC5160::setTargetPosition(float position)
 {
-    writeRegister(ADDRESS_XTARGET, (int32_t)(position * (float)_uStepCount));
+    writeRegister(ADDRESS_XTARGET, (int32_t)(position * (float)_uSteps));
+}
+
+void TMC5160::setCurrentPositionMicrosteps(int32_t position, bool updateEncoderPos)
+{
+    Batch batch(*this);
+
+    writeRegister(ADDRESS_XACTUAL, position);
+
+    if (updateEncoderPos)
+    {
+        writeRegister(ADDRESS_X_ENC, position);
+        clearEncoderDeviationFlag();
+    }
+}
+
+void TMC5160::setExtendedPosition(int64_t position, bool updateEncoderPos)
+{
+    _extendedPosition.value = position;
+    _extendedPosition.preset = true;
+    if (updateEncoderPos) {
+        _extendedEncoderPosition.value = position;
+        _extendedEncoderPosition.preset = true;
+    }
+
+    setCurrentPositionMicrosteps((uint32_t)position, updateEncoderPos);
 }
 
 
 
 void TMC5160::moveAtVelocity(float speed) {
-    writeRegister(ADDRESS_VMAX, min(0x7FFFFF, speedFromHz(fabs(speed)))); // VMAX : 23 bits
+    moveAtVelocityRaw(speedFromHz(speed));
+}
+
+void TMC5160::moveAtVelocityRaw(int32_t vmax)
+{
+    Batch batch(*this);
+
+    uint32_t speed = vmax < 0 ? -(uint32_t)vmax : (uint32_t)vmax;
+    writeRegister(ADDRESS_VMAX, min((uint32_t)0x7FFFFF, speed)); // VMAX : 23 bits
 
     if (_currentRampMode == VELOCITY_MODE)
     {
-        writeRegister(ADDRESS_RAMPMODE, speed < 0.0f ? VELOCITY_MODE_NEG : VELOCITY_MODE_POS);
+        writeRegister(ADDRESS_RAMPMODE, vmax < 0 ? VELOCITY_MODE_NEG : VELOCITY_MODE_POS);
     }
 }
 
 void TMC5160::setRampSpeeds(float startSpeed, float stopSpeed, float transitionSpeed)
 {
-    writeRegister(ADDRESS_VSTART, speedFromHz(fabs(startSpeed)));
-    writeRegister(ADDRESS_VSTOP, speedFromHz(fabs(stopSpeed)));
-    writeRegister(ADDRESS_V_1, speedFromHz(fabs(transitionSpeed)));
+    Batch batch(*this);
+
+    writeRegister(ADDRESS_VSTART, min((uint32_t)0x3FFFF, (uint32_t)speedFromHz(fabs(startSpeed)))); // VSTART, VSTOP : 18 bits
+    writeRegister(ADDRESS_VSTOP, min((uint32_t)0x3FFFF, (uint32_t)speedFromHz(fabs(stopSpeed))));
+    writeRegister(ADDRESS_V_1, min((uint32_t)0xFFFFF, (uint32_t)speedFromHz(fabs(transitionSpeed)))); // V1 : 20 bits
 }
 
 void TMC5160::setAcceleration(float maxAccel)
 {
-    writeRegister(ADDRESS_AMAX, accelFromHz(fabs(maxAccel)));
+    setAccelerationRaw(accelFromHz(fabs(maxAccel)));
+}
+
+void TMC5160::setAccelerationRaw(uint32_t amax)
+{
+    writeRegister(ADDRESS_AMAX, min((uint32_t)0xFFFF, amax)); // AMAX : 16 bits
 }
 
 void TMC5160::setAccelerations(float maxAccel, float startAccel, float maxDecel, float finalDecel)
 {
-    writeRegister(ADDRESS_DMAX, accelFromHz(fabs(maxDecel)));
-    writeRegister(ADDRESS_AMAX, accelFromHz(fabs(maxAccel)));
-    writeRegister(ADDRESS_A_1, accelFromHz(fabs(startAccel)));
-    writeRegister(ADDRESS_D_1, accelFromHz(fabs(finalDecel)));
+    Batch batch(*this);
+
+    // 16 bits each, saturated like setAccelerationRaw()
+    writeRegister(ADDRESS_DMAX, min((uint32_t)0xFFFF, (uint32_t)accelFromHz(fabs(maxDecel))));
+    writeRegister(ADDRESS_AMAX, min((uint32_t)0xFFFF, (uint32_t)accelFromHz(fabs(maxAccel))));
+    writeRegister(ADDRESS_A_1, min((uint32_t)0xFFFF, (uint32_t)accelFromHz(fabs(startAccel))));
+    writeRegister(ADDRESS_D_1, min((uint32_t)0xFFFF, (uint32_t)accelFromHz(fabs(finalDecel))));
 }
 
 /**
@@ -224,6 +684,8 @@ bool TMC5160::isTargetVelocityReached(void)
 
 void TMC5160::earlyRampTermination()
 {
+    Batch batch(*this);
+
     writeRegister(ADDRESS_VSTART, 0);
     writeRegister(ADDRESS_VMAX, 0);
 }
@@ -243,7 +705,17 @@ void TMC5160::enable()
 bool TMC5160::isResetOccurred()
 {
     globalStatus.bytes = readRegister(ADDRESS_GSTAT);
-    return globalStatus.reset;
+
+    if (globalStatus.reset)
+        invalidateShadow();
+
+    return _takeResetLatch() || globalStatus.reset;
+}
+
+bool TMC5160::isStallDetected()
+{
+    drvStatus.bytes = readRegister(ADDRESS_DRV_STATUS);
+    return drvStatus.stallguard;
 }
 
 
@@ -252,6 +724,9 @@ DriverStatus TMC5160::getDriverStatus()
     globalStatus.bytes = readRegister(ADDRESS_GSTAT);
     drvStatus.bytes = readRegister(ADDRESS_DRV_STATUS);
 
+    if (globalStatus.reset)
+        _resetDetected();
+
     if (globalStatus.uv_cp)
         return CP_UV;
     if (drvStatus.s2vsa)
@@ -299,6 +774,8 @@ void TMC5160::printDriverStatusDescription(DriverStatus st) {
 
 void TMC5160::setModeChangeSpeeds(float pwmThrs, float coolThrs, float highThrs)
 {
+    Batch batch(*this);
+
     writeRegister(ADDRESS_TPWMTHRS, min(0xFFFFF, thrsSpeedToTstep(pwmThrs))); // 20 bits
     writeRegister(ADDRESS_TCOOLTHRS, min(0xFFFFF, thrsSpeedToTstep(coolThrs)));
     writeRegister(ADDRESS_THIGH, min(0xFFFFF, thrsSpeedToTstep(highThrs)));
@@ -321,12 +798,14 @@ void TMC5160::setModeChangeSpeeds(float pwmThrs, float coolThrs, float highThrs)
 
 bool TMC5160::setEncoderResolution(int motorSteps, int encResolution, bool inverted)
 {
-    float factor = (float)motorSteps * (float)_uStepCount / (float)encResolution;
+    Batch batch(*this);
+
+    float factor = (float)motorSteps * (float)_uSteps / (float)encResolution;
 
     // Check if the binary prescaler gives an exact match
-    if ((int)(factor * 65536.0f) * encResolution == motorSteps * _uStepCount * 65536)
+    if ((int)(factor * 65536.0f) * encResolution == motorSteps * _uSteps * 65536)
     {
-        encmode.bytes = readRegister(ADDRESS_ENCMODE);
+        encmode.bytes = readShadowRegister(ADDRESS_ENCMODE);
         encmode.enc_sel_decimal = false;
         writeRegister(ADDRESS_ENCMODE, encmode.bytes);
 
@@ -347,7 +826,7 @@ bool TMC5160::setEncoderResolution(int motorSteps, int encResolution, bool inver
     }
     else
     {
-        encmode.bytes = readRegister(ADDRESS_ENCMODE);
+        encmode.bytes = readShadowRegister(ADDRESS_ENCMODE);
         encmode.enc_sel_decimal = true;
         writeRegister(ADDRESS_ENCMODE, encmode.bytes);
 
@@ -373,7 +852,7 @@ bool TMC5160::setEncoderResolution(int motorSteps, int encResolution, bool inver
 
         // Check if the decimal prescaler gives an exact match. Floats have about 7 digits of precision so no worries
         // here.
-        return ((int)(factor * 10000.0f) * encResolution == motorSteps * (int)_uStepCount * 10000);
+        return ((int)(factor * 10000.0f) * encResolution == motorSteps * (int)_uSteps * 10000);
     }
 }
 
@@ -388,7 +867,7 @@ bool TMC5160::setEncoderResolution(int motorSteps, int encResolution, bool inver
 void TMC5160::setEncoderIndexConfiguration(ENCMODE_sensitivity_Values sensitivity, bool nActiveHigh,
                                            bool ignorePol, bool aActiveHigh, bool bActiveHigh)
 {
-    encmode.bytes = readRegister(ADDRESS_ENCMODE);
+    encmode.bytes = readShadowRegister(ADDRESS_ENCMODE);
 
     encmode.sensitivity = sensitivity;
     encmode.pol_N = nActiveHigh;
@@ -406,7 +885,7 @@ void TMC5160::setEncoderIndexConfiguration(ENCMODE_sensitivity_Values sensitivit
 
 void TMC5160::setEncoderLatching(bool enabled)
 {
-    encmode.bytes = readRegister(ADDRESS_ENCMODE);
+    encmode.bytes = readShadowRegister(ADDRESS_ENCMODE);
 
     encmode.latch_x_act = true;
     encmode.clr_cont = enabled;
@@ -415,6 +894,8 @@ void TMC5160::setEncoderLatching(bool enabled)
 }
 
 void TMC5160::setCurrentMilliamps(uint16_t Irms) {
+    Batch batch(*this);
+
     const int32_t const_val = 11585;  //256 * Sqroot(2) * 32
     const int32_t Vfs = 325;
     const float Rsense = 0.075f;
@@ -453,7 +934,7 @@ void TMC5160::setCurrentMilliamps(uint16_t Irms) {
 
 void TMC5160::setEncoderAllowedDeviation(int steps)
 {
-    writeRegister(ADDRESS_ENC_DEVIATION, steps * _uStepCount);
+    writeRegister(ADDRESS_ENC_DEVIATION, steps * _uSteps);
 }
 
     /* Check if a deviation between internal pos and encoder has been detected */
@@ -496,40 +977,151 @@ void TMC5160::setShortProtectionLevels(int s2vsLevel, int s2gLevel, int shortFil
 
 
 TMC5160_SPI::TMC5160_SPI( uint8_t chipSelectPin, uint32_t fclk, const SPISettings &spiSettings, SPIClass &spi )
-: TMC5160(fclk), _CS(chipSelectPin), _spiSettings(spiSettings), _spi(&spi)
+: TMC5160(fclk), _CS(chipSelectPin), _spiSettings(spiSettings), _spi(&spi), _spiStatusMicros(0), _statusMaxAge(0),
+  _backend(nullptr), _asyncHead(0), _asyncCount(0), _asyncBusy(false), _asyncInCallback(false), _busClaimed(false)
 {
+	_spiStatus.bytes = 0;
 	pinMode(chipSelectPin, OUTPUT);
+	TMC5160_TRACE(_trace.setSource(TMC5160_Trace::TRANSPORT_SPI, 0));
 }
 
 
-// calls to read/write registers must be bracketed by the begin/endTransaction calls
+// datagram transfers must be bracketed by the begin/endTransaction calls, which claim the bus
 
 void _chipSelect( uint8_t pin, bool select )
 {
 	digitalWrite(pin, select?LOW:HIGH);
 }
 
+// 40-bit datagram : address / status byte followed by the data, MSB first
+
+static void _packDatagram( uint8_t *buffer, uint8_t address, uint32_t data )
+{
+	buffer[0] = address;
+	for (uint8_t i = 0; i < 4; i++)
+		buffer[1 + i] = (data >> ((3 - i) * 8)) & 0xFF;
+}
+
+static uint32_t _unpackDatagram( const uint8_t *buffer )
+{
+	uint32_t value = 0;
+	for (uint8_t i = 0; i < 4; i++)
+		value |= (uint32_t)buffer[1 + i] << ((3 - i) * 8);
+	return value;
+}
+
+/* Critical sections of the asynchronous queue, also entered from the completion interrupt :
+ * restore the interrupt state instead of enabling interrupts unconditionally. */
+#if defined(__AVR__)
+typedef uint8_t _InterruptState;
+
+static inline _InterruptState _disableInterrupts()
+{
+	_InterruptState state = SREG;
+	cli();
+	return state;
+}
+
+static inline void _restoreInterrupts(_InterruptState state)
+{
+	SREG = state;
+}
+#elif defined(__ARM_ARCH_6M__) || defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+typedef uint32_t _InterruptState;
+
+static inline _InterruptState _disableInterrupts()
+{
+	_InterruptState primask;
+	__asm__ volatile("mrs %0, primask" : "=r"(primask));
+	__asm__ volatile("cpsid i" ::: "memory");
+	return primask;
+}
+
+static inline void _restoreInterrupts(_InterruptState primask)
+{
+	__asm__ volatile("msr primask, %0" :: "r"(primask) : "memory");
+}
+#else
+// No portable way to read the interrupt state : the completion handler must not run with interrupts masked
+typedef uint8_t _InterruptState;
+
+static inline _InterruptState _disableInterrupts()
+{
+	noInterrupts();
+	return 0;
+}
+
+static inline void _restoreInterrupts(_InterruptState)
+{
+	interrupts();
+}
+#endif
+
 void TMC5160_SPI::_beginTransaction()
 {
-	_spi->beginTransaction(_spiSettings);
-	_chipSelect(_CS, true);
+	if (!_busClaimed)
+		_spi->beginTransaction(_spiSettings);
 }
 
 void TMC5160_SPI::_endTransaction()
 {
-	_chipSelect(_CS, false);
+	if (!_busClaimed)
+		_spi->endTransaction();
+}
+
+void TMC5160_SPI::_onBatchBegin()
+{
+	_waitAsyncIdle();
+	_spi->beginTransaction(_spiSettings);
+	_busClaimed = true;
+}
+
+void TMC5160_SPI::_onBatchEnd()
+{
+	_busClaimed = false;
 	_spi->endTransaction();
 }
 
+uint32_t TMC5160_SPI::_transferDatagram(uint8_t address, uint32_t data, uint8_t *status)
+{
+    uint8_t buffer[DATAGRAM_LENGTH];
+    _packDatagram(buffer, address, data);
+
+#if defined(TMC5160_ENABLE_STATS) || defined(TMC5160_ENABLE_TRACE)
+    unsigned long startTime = micros();
+#endif
+
+    _chipSelect(_CS, true);
+    _spi->transfer(buffer, DATAGRAM_LENGTH);
+    _chipSelect(_CS, false);
+
+    TMC5160_STATS(unsigned long latency = micros() - startTime;
+                  _stats.recordAccess(address, address & WRITE_ACCESS, latency);
+                  _stats.busTime += latency;
+                  _stats.bytesSent += DATAGRAM_LENGTH;
+                  _stats.bytesReceived += DATAGRAM_LENGTH);
+
+    _spiStatus.bytes = buffer[0];
+    _spiStatusMicros = micros();
+
+    if (_spiStatus.reset_flag)
+        _resetDetected();
+
+    if (status != nullptr)
+        *status = buffer[0];
+
+    uint32_t received = _unpackDatagram(buffer);
+    TMC5160_TRACE(_trace.record(address, (address & WRITE_ACCESS) ? data : received, buffer[0], startTime));
+
+    return received;
+}
+
 uint32_t TMC5160_SPI::readRegister(uint8_t address)
 {
-    _beginTransaction();
-    _spi->transfer(address);
+    _waitAsyncIdle();
 
-    uint32_t value = 0;
-    for (int8_t shift = 24; shift >= 0; shift -= 8) {
-        value |= (uint32_t)_spi->transfer(0x00) << shift;
-    }
+    _beginTransaction();
+    uint32_t value = _transferDatagram(address, 0, nullptr);
     _endTransaction();
 
     return value;
@@ -538,58 +1130,472 @@ uint32_t TMC5160_SPI::readRegister(uint8_t address)
 
 uint8_t TMC5160_SPI::writeRegister(uint8_t address, uint32_t data)
 {
-    // address register
-    _beginTransaction();
-    uint8_t status = _spi->transfer(address | WRITE_ACCESS);
+    uint8_t status;
 
-    // send new register value
-    for (int8_t shift = 24; shift >= 0; shift -= 8) {
-        _spi->transfer((data >> shift) & 0xFF);
-    }
+    _waitAsyncIdle();
+
+    if (_isRedundantWrite(address, data))
+        return _spiStatus.bytes;
+
+    _beginTransaction();
+    _transferDatagram(address | WRITE_ACCESS, data, &status);
     _endTransaction();
 
+    _registerWritten(address, data);
+
     return status;
 }
 
+void TMC5160_SPI::readRegisters(const uint8_t *addresses, uint32_t *values, size_t count)
+{
+    if (count == 0)
+        return;
+
+    _waitAsyncIdle();
 
+    // Keep the bus claimed for the whole burst, only pulse CS between datagrams.
+    _beginTransaction();
 
+    // The first reply carries the result of whatever was accessed before : discard it.
+    _transferDatagram(addresses[0], 0, nullptr);
 
-TMC5160_UART_Generic::TMC5160_UART_Generic(uint8_t slaveAddress, uint32_t fclk)
-: TMC5160(fclk), _slaveAddress(slaveAddress), _currentMode(STREAMING_MODE)
-{
+    for (size_t i = 1; i < count; i++) {
+        values[i - 1] = _transferDatagram(addresses[i], 0, nullptr);
+    }
 
+    values[count - 1] = _transferDatagram(PIPELINE_FLUSH_ADDRESS, 0, nullptr);
+
+    _endTransaction();
 }
 
-bool TMC5160_UART_Generic::begin()
+bool TMC5160_SPI::submitRead(uint8_t address, AsyncCallback callback, void *context)
 {
-    CommunicationMode oldMode = _currentMode;
-    setCommunicationMode(RELIABLE_MODE);
+    return _submit(address, 0, callback, context);
+}
 
-    // SLAVECONF_Register slaveConf = { 0 };
-    // slaveConf.senddelay = 2; // minimum if more than one slave is present.
-    // writeRegister(ADDRESS_SLAVECONF, slaveConf.bytes);
+bool TMC5160_SPI::submitWrite(uint8_t address, uint32_t data, AsyncCallback callback, void *context)
+{
+    if (_isRedundantWrite(address, data)) {
+        if (callback != nullptr)
+            callback(context, 0, _spiStatus);
+        return true;
+    }
 
-    bool result = TMC5160::begin();
-    setCommunicationMode(oldMode);
-    return result;
+    if (!_submit(address | WRITE_ACCESS, data, callback, context))
+        return false;
+
+    _registerWritten(address, data);
+    return true;
 }
 
-uint32_t TMC5160_UART_Generic::readRegister(uint8_t address, ReadStatus *status)
+bool TMC5160_SPI::_submit(uint8_t address, uint32_t data, AsyncCallback callback, void *context)
 {
-    uint32_t data = 0xFFFFFFFF;
-    ReadStatus readStatus;
+    _InterruptState state = _disableInterrupts();
+    if (_asyncCount >= ASYNC_QUEUE_LENGTH) {
+        _restoreInterrupts(state);
+        return false;
+    }
 
-    switch (_currentMode)
-    {
-    case STREAMING_MODE:
-        data = _readReg(address, &readStatus);
-        break;
+    AsyncTransaction &transaction = _asyncQueue[(_asyncHead + _asyncCount) % ASYNC_QUEUE_LENGTH];
+    _packDatagram(transaction.buffer, address, data);
+    transaction.callback = callback;
+    transaction.context = context;
+    _asyncCount++;
+    _restoreInterrupts(state);
 
-    case RELIABLE_MODE: {
-        int retries = NB_RETRIES_READ;
-        readStatus = NO_REPLY; // Worst case. If there is no reply for all retries this should be notified to the user.
-        do
+    _startNextTransaction();
+    return true;
+}
+
+void TMC5160_SPI::_startNextTransaction()
+{
+    _InterruptState state = _disableInterrupts();
+    if (_asyncBusy || _asyncCount == 0) {
+        _restoreInterrupts(state);
+        return;
+    }
+    _asyncBusy = true;
+    _restoreInterrupts(state);
+
+    uint8_t *buffer = _asyncQueue[_asyncHead].buffer;
+
+#if defined(TMC5160_ENABLE_STATS) || defined(TMC5160_ENABLE_TRACE)
+    _asyncAddress = buffer[0];
+    _asyncStartMicros = micros();
+#endif
+    TMC5160_TRACE(_asyncData = _unpackDatagram(buffer));
+
+    if (_backend != nullptr) {
+        _backend->startTransfer(buffer, DATAGRAM_LENGTH, _onTransferComplete, this);
+    } else {
+        _beginTransaction();
+        _chipSelect(_CS, true);
+        _spi->transfer(buffer, DATAGRAM_LENGTH);
+        _chipSelect(_CS, false);
+        _endTransaction();
+
+        _onTransferComplete(this);
+    }
+}
+
+void TMC5160_SPI::_onTransferComplete(void *context)
+{
+    TMC5160_SPI *self = static_cast<TMC5160_SPI *>(context);
+    AsyncTransaction &transaction = self->_asyncQueue[self->_asyncHead];
+
+    self->_spiStatus.bytes = transaction.buffer[0];
+    self->_spiStatusMicros = micros();
+
+    TMC5160_STATS(unsigned long latency = self->_spiStatusMicros - self->_asyncStartMicros;
+                  self->_stats.recordAccess(self->_asyncAddress, self->_asyncAddress & WRITE_ACCESS, latency);
+                  self->_stats.busTime += latency;
+                  self->_stats.bytesSent += DATAGRAM_LENGTH;
+                  self->_stats.bytesReceived += DATAGRAM_LENGTH);
+
+    if (self->_spiStatus.reset_flag)
+        self->_resetDetected();
+
+    uint32_t data = _unpackDatagram(transaction.buffer);
+    TMC5160_TRACE(self->_trace.record(self->_asyncAddress, (self->_asyncAddress & WRITE_ACCESS) ? self->_asyncData : data,
+                                      transaction.buffer[0], self->_asyncStartMicros));
+
+    AsyncCallback callback = transaction.callback;
+    void *callbackContext = transaction.context;
+
+    // Release the slot before calling back so that the callback may submit the next transaction
+    self->_asyncHead = (self->_asyncHead + 1) % ASYNC_QUEUE_LENGTH;
+    self->_asyncCount--;
+    self->_asyncBusy = false;
+
+    if (callback != nullptr) {
+        self->_asyncInCallback = true;
+        callback(callbackContext, data, self->_spiStatus);
+        self->_asyncInCallback = false;
+    }
+
+    self->_startNextTransaction();
+}
+
+void TMC5160_SPI::_waitAsyncIdle()
+{
+    // The queue only moves on once the callback returns : waiting from it would never end.
+    // The bus is free meanwhile, so the access goes ahead of the queued transactions.
+    if (_asyncInCallback)
+        return;
+
+    while (_asyncCount != 0)
+        ;
+}
+
+uint32_t TMC5160_SPI::_readRegisterExact(uint8_t address)
+{
+    uint32_t value;
+    readRegisters(&address, &value, 1);
+    return value;
+}
+
+bool TMC5160_SPI::_isStatusFresh()
+{
+    return _statusMaxAge != 0 && _spiStatusMicros != 0 && micros() - _spiStatusMicros <= _statusMaxAge;
+}
+
+bool TMC5160_SPI::isTargetPositionReached(void)
+{
+    if (_isStatusFresh())
+        return _spiStatus.position_reached;
+
+    return TMC5160::isTargetPositionReached();
+}
+
+bool TMC5160_SPI::isTargetVelocityReached(void)
+{
+    if (_isStatusFresh())
+        return _spiStatus.velocity_reached;
+
+    return TMC5160::isTargetVelocityReached();
+}
+
+bool TMC5160_SPI::isResetOccurred()
+{
+    // The reset flag stays set until ADDRESS_GSTAT is read, which is what clears it.
+    if (_isStatusFresh() && !_spiStatus.reset_flag)
+        return _takeResetLatch();
+
+    return TMC5160::isResetOccurred();
+}
+
+bool TMC5160_SPI::isStallDetected()
+{
+    if (_isStatusFresh())
+        return _spiStatus.sg2;
+
+    return TMC5160::isStallDetected();
+}
+
+
+
+
+TMC5160_SPI_Chain::TMC5160_SPI_Chain(uint8_t chipSelectPin, uint8_t length, const SPISettings &spiSettings,
+                                     SPIClass &spi)
+: _CS(chipSelectPin), _length(constrain(length, 1, MAX_CHAIN_LENGTH)), _spiSettings(spiSettings), _spi(&spi),
+  _updating(false), _queued(0)
+{
+    for (uint8_t i = 0; i < MAX_CHAIN_LENGTH; i++) {
+        _rxData[i] = 0;
+        _rxStatus[i].bytes = 0;
+    }
+
+    pinMode(chipSelectPin, OUTPUT);
+    _chipSelect(_CS, false);
+}
+
+void TMC5160_SPI_Chain::queueRead(uint8_t slot, uint8_t address)
+{
+    if (slot >= _length)
+        return;
+
+    _txAddress[slot] = address & ~WRITE_ACCESS;
+    _txData[slot] = 0;
+    _queued |= (1 << slot);
+}
+
+void TMC5160_SPI_Chain::queueWrite(uint8_t slot, uint8_t address, uint32_t data)
+{
+    if (slot >= _length)
+        return;
+
+    _txAddress[slot] = address | WRITE_ACCESS;
+    _txData[slot] = data;
+    _queued |= (1 << slot);
+}
+
+void TMC5160_SPI_Chain::transfer()
+{
+    uint8_t buffer[MAX_CHAIN_LENGTH * 5];
+
+    // The first datagram shifted in ends up in the last driver of the chain, and the first one
+    // shifted out comes from it as well.
+    for (uint8_t slot = 0; slot < _length; slot++) {
+        uint8_t *datagram = buffer + (_length - 1 - slot) * 5;
+        if (isQueued(slot))
+            _packDatagram(datagram, _txAddress[slot], _txData[slot]);
+        else
+            _packDatagram(datagram, NOP_ADDRESS, 0);
+    }
+
+    _spi->beginTransaction(_spiSettings);
+    _chipSelect(_CS, true);
+    _spi->transfer(buffer, _length * 5);
+    _chipSelect(_CS, false);
+    _spi->endTransaction();
+
+    for (uint8_t slot = 0; slot < _length; slot++) {
+        const uint8_t *datagram = buffer + (_length - 1 - slot) * 5;
+        _rxStatus[slot].bytes = datagram[0];
+        _rxData[slot] = _unpackDatagram(datagram);
+    }
+
+    _queued = 0;
+}
+
+void TMC5160_SPI_Chain::writeAll(uint8_t address, uint32_t data)
+{
+    for (uint8_t slot = 0; slot < _length; slot++)
+        queueWrite(slot, address, data);
+
+    transfer();
+}
+
+void TMC5160_SPI_Chain::writeAll(uint8_t address, const uint32_t *data)
+{
+    for (uint8_t slot = 0; slot < _length; slot++)
+        queueWrite(slot, address, data[slot]);
+
+    transfer();
+}
+
+void TMC5160_SPI_Chain::readAll(uint8_t address, uint32_t *values)
+{
+    for (uint8_t slot = 0; slot < _length; slot++)
+        queueRead(slot, address);
+    transfer();
+
+    // Replies come with the next datagram
+    transfer();
+
+    for (uint8_t slot = 0; slot < _length; slot++)
+        values[slot] = _rxData[slot];
+}
+
+void TMC5160_SPI_Chain::endUpdate()
+{
+    _updating = false;
+
+    if (_queued)
+        transfer();
+}
+
+
+
+
+TMC5160_SPI_ChainDevice::TMC5160_SPI_ChainDevice(TMC5160_SPI_Chain &chain, uint8_t slot, uint32_t fclk)
+: TMC5160(fclk), _chain(&chain), _slot(slot < chain.getLength() ? slot : chain.getLength() - 1)
+{
+    TMC5160_TRACE(_trace.setSource(TMC5160_Trace::TRANSPORT_SPI_CHAIN, _slot));
+}
+
+// Traced per register access : the chain transactions are shared with the other drivers
+uint32_t TMC5160_SPI_ChainDevice::readRegister(uint8_t address)
+{
+    TMC5160_TRACE(unsigned long startTime = micros());
+
+    // Pending writes must reach the chip before reading back
+    if (_chain->isUpdating() && _chain->isQueued(_slot))
+        _chain->transfer();
+
+    _chain->queueRead(_slot, address);
+    _chain->transfer();
+
+    // The requested data is returned with the next datagram
+    _chain->transfer();
+
+    if (_chain->getReplyStatus(_slot).reset_flag)
+        _resetDetected();
+
+    TMC5160_TRACE(_trace.record(address, _chain->getReplyData(_slot), _chain->getReplyStatus(_slot).bytes, startTime));
+
+    return _chain->getReplyData(_slot);
+}
+
+uint8_t TMC5160_SPI_ChainDevice::writeRegister(uint8_t address, uint32_t data)
+{
+    if (_isRedundantWrite(address, data))
+        return _chain->getReplyStatus(_slot).bytes;
+
+    TMC5160_TRACE(unsigned long startTime = micros());
+
+    if (_chain->isUpdating()) {
+        if (_chain->isQueued(_slot))
+            _chain->transfer();
+
+        _chain->queueWrite(_slot, address, data);
+    } else {
+        _chain->queueWrite(_slot, address, data);
+        _chain->transfer();
+
+        if (_chain->getReplyStatus(_slot).reset_flag)
+            _resetDetected();
+    }
+
+    _registerWritten(address, data);
+    TMC5160_TRACE(_trace.record(address | WRITE_ACCESS, data, _chain->getReplyStatus(_slot).bytes, startTime));
+
+    return _chain->getReplyStatus(_slot).bytes;
+}
+
+
+
+
+/* UART datagram CRC8 : polynomial x^8 + x^2 + x + 1, each byte fed LSB first (datasheet §5.2).
+ * Feeding bits LSB first is the bit-reflected form of the usual CRC8, so the running value is kept
+ * reflected (shift right, polynomial 0xE0) and only reversed once, at the end of the datagram. */
+static constexpr uint8_t _crcShift(uint8_t crc, uint8_t bits)
+{
+    return bits == 0 ? crc : _crcShift((crc & 0x01) ? (uint8_t)((crc >> 1) ^ 0xE0) : (uint8_t)(crc >> 1), bits - 1);
+}
+
+#if defined(__AVR__)
+// 16 entries, one lookup per nibble : keeps flash and RAM usage low on small boards
+#define CRC_NIBBLE(i) _crcShift(i, 4)
+static const uint8_t CRC_TABLE[16] = {
+    CRC_NIBBLE(0x0), CRC_NIBBLE(0x1), CRC_NIBBLE(0x2), CRC_NIBBLE(0x3), CRC_NIBBLE(0x4), CRC_NIBBLE(0x5),
+    CRC_NIBBLE(0x6), CRC_NIBBLE(0x7), CRC_NIBBLE(0x8), CRC_NIBBLE(0x9), CRC_NIBBLE(0xA), CRC_NIBBLE(0xB),
+    CRC_NIBBLE(0xC), CRC_NIBBLE(0xD), CRC_NIBBLE(0xE), CRC_NIBBLE(0xF)
+};
+#undef CRC_NIBBLE
+
+static inline uint8_t _crcUpdate(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    crc = (crc >> 4) ^ CRC_TABLE[crc & 0x0F];
+    return (crc >> 4) ^ CRC_TABLE[crc & 0x0F];
+}
+#else
+#define CRC_ENTRY(i) _crcShift(i, 8)
+#define CRC_ROW(i) CRC_ENTRY(i + 0x0), CRC_ENTRY(i + 0x1), CRC_ENTRY(i + 0x2), CRC_ENTRY(i + 0x3), \
+                   CRC_ENTRY(i + 0x4), CRC_ENTRY(i + 0x5), CRC_ENTRY(i + 0x6), CRC_ENTRY(i + 0x7), \
+                   CRC_ENTRY(i + 0x8), CRC_ENTRY(i + 0x9), CRC_ENTRY(i + 0xA), CRC_ENTRY(i + 0xB), \
+                   CRC_ENTRY(i + 0xC), CRC_ENTRY(i + 0xD), CRC_ENTRY(i + 0xE), CRC_ENTRY(i + 0xF)
+static const uint8_t CRC_TABLE[256] = {
+    CRC_ROW(0x00), CRC_ROW(0x10), CRC_ROW(0x20), CRC_ROW(0x30), CRC_ROW(0x40), CRC_ROW(0x50), CRC_ROW(0x60), CRC_ROW(0x70),
+    CRC_ROW(0x80), CRC_ROW(0x90), CRC_ROW(0xA0), CRC_ROW(0xB0), CRC_ROW(0xC0), CRC_ROW(0xD0), CRC_ROW(0xE0), CRC_ROW(0xF0)
+};
+#undef CRC_ROW
+#undef CRC_ENTRY
+
+static inline uint8_t _crcUpdate(uint8_t crc, uint8_t byte)
+{
+    return CRC_TABLE[crc ^ byte];
+}
+#endif
+
+// Back from the reflected running value to the CRC byte sent on the wire
+static inline uint8_t _crcFinal(uint8_t crc)
+{
+    crc = (crc >> 4) | (crc << 4);
+    crc = ((crc & 0xCC) >> 2) | ((crc & 0x33) << 2);
+    return ((crc & 0xAA) >> 1) | ((crc & 0x55) << 1);
+}
+
+TMC5160_UART_Generic::TMC5160_UART_Generic(uint8_t slaveAddress, uint32_t fclk)
+: TMC5160(fclk), _slaveAddress(slaveAddress), _nai(slaveAddress != 0), _currentMode(STREAMING_MODE), _baudRate(0), _sendDelay(0),
+  _adaptive(false), _adaptGap(false), _escalateErrors(DEFAULT_ESCALATE_ERRORS), _recoverErrors(DEFAULT_RECOVER_ERRORS),
+  _gapShift(0), _modeTransitions(0), _batchLength(0), _pendingCount(0), _verifiedWriteStatus(SUCCESS), _verifyingWrites(false),
+  _rxLength(0), _asyncHead(0), _asyncCount(0), _asyncWaitingReply(false), _asyncStartTime(0), _bus(nullptr)
+{
+    _updateTiming();
+    _resetErrorWindow();
+    TMC5160_TRACE(_trace.setSource(TMC5160_Trace::TRANSPORT_UART, _slaveAddress));
+}
+
+bool TMC5160_UART_Generic::begin()
+{
+    CommunicationMode oldMode = getCommunicationMode();
+    setCommunicationMode(RELIABLE_MODE);
+
+    // SLAVECONF_Register slaveConf = { 0 };
+    // slaveConf.senddelay = 2; // minimum if more than one slave is present.
+    // writeRegister(ADDRESS_SLAVECONF, slaveConf.bytes);
+
+    bool result = TMC5160::begin();
+    setCommunicationMode(oldMode);
+    return result;
+}
+
+uint32_t TMC5160_UART_Generic::readRegister(uint8_t address, ReadStatus *status)
+{
+    uint32_t data = 0xFFFFFFFF;
+    ReadStatus readStatus;
+
+    _waitAsyncIdle();
+    TMC5160_STATS(unsigned long startTime = micros());
+    _flushVerifiedWrites(); // Reads must see the queued writes
+    _adaptMode();
+
+    switch (_currentMode)
+    {
+    case STREAMING_MODE:
+    case ADAPTIVE_MODE: // Never the effective mode
+        data = _readReg(address, &readStatus);
+        break;
+
+    case RELIABLE_MODE: {
+        int retries = NB_RETRIES_READ;
+        readStatus = NO_REPLY; // Worst case. If there is no reply for all retries this should be notified to the user.
+        do
         {
+            TMC5160_STATS(if (retries != NB_RETRIES_READ) _stats.retries++);
+
             ReadStatus trialStatus;
             data = _readReg(address, &trialStatus);
 
@@ -608,25 +1614,56 @@ uint32_t TMC5160_UART_Generic::readRegister(uint8_t address, ReadStatus *status)
     if (status != nullptr)
         *status = readStatus;
 
+    TMC5160_STATS(_stats.recordAccess(address, false, micros() - startTime));
+
     return data;
 }
 
 uint8_t TMC5160_UART_Generic::writeRegister(uint8_t address, uint32_t data, ReadStatus *status)
 {
+    _waitAsyncIdle();
+    _adaptMode();
+
+    if (_isRedundantWrite(address, data)) {
+        if (status != nullptr)
+            *status = SUCCESS;
+        return 0;
+    }
+
+    TMC5160_STATS(unsigned long startTime = micros());
+
     switch (_currentMode)
     {
     case STREAMING_MODE:
+    case ADAPTIVE_MODE: // Never the effective mode
         _writeReg(address, data);
+        _registerWritten(address, data);
 
         if (status != nullptr)
             *status = SUCCESS;
         break;
 
     case RELIABLE_MODE: {
+        if (isBatching()) {
+            // Verified together with the other writes of the burst
+            if (_pendingCount >= BATCH_BUFFER_DATAGRAMS)
+                _flushVerifiedWrites();
+
+            _pendingAddresses[_pendingCount] = address;
+            _pendingData[_pendingCount] = data;
+            _pendingCount++;
+
+            if (status != nullptr)
+                *status = SUCCESS;
+            break;
+        }
+
         int retries = NB_RETRIES_WRITE;
         ReadStatus writeStatus = NO_REPLY;
         do
         {
+            TMC5160_STATS(if (retries != NB_RETRIES_WRITE) _stats.retries++);
+
             _writeReg(address, data);
             _writeAttemptsCounter++;
 
@@ -638,8 +1675,10 @@ uint8_t TMC5160_UART_Generic::writeRegister(uint8_t address, uint32_t data, Read
 
             if (readStatus == SUCCESS)
             {
-                if (counter != _transmissionCounter + 1)
+                if (counter != (uint8_t)(_transmissionCounter + 1)) {
                     writeStatus = BAD_CRC;
+                    _recordOutcome(false); // The IFCNT read itself succeeded
+                }
 
                 _transmissionCounter = counter;
             }
@@ -650,22 +1689,113 @@ uint8_t TMC5160_UART_Generic::writeRegister(uint8_t address, uint32_t data, Read
         if (status != nullptr)
             *status = writeStatus;
 
-        if (writeStatus == SUCCESS)
+        if (writeStatus == SUCCESS) {
             _writeSuccessfulCounter++;
+            _registerWritten(address, data);
+        } else {
+            _registerWriteFailed(address);
+        }
 
         break;
     }
     }
 
+    TMC5160_STATS(_stats.recordAccess(address, true, micros() - startTime));
+
     return 0;
 }
 
+uint8_t TMC5160_UART_Generic::writeRegisters(const uint8_t *addresses, const uint32_t *data, uint8_t count,
+                                             ReadStatus *status)
+{
+    {
+        Batch batch(*this);
+        _verifiedWriteStatus = SUCCESS;
+
+        for (uint8_t i = 0; i < count; i++)
+            writeRegister(addresses[i], data[i]);
+
+        _flushVerifiedWrites();
+    }
+
+    if (status != nullptr)
+        *status = _verifiedWriteStatus;
+
+    return 0;
+}
+
+void TMC5160_UART_Generic::_flushVerifiedWrites()
+{
+    if (_pendingCount == 0)
+        return;
+
+    uint8_t count = _pendingCount;
+    _pendingCount = 0;
+
+    _verifyingWrites = true;
+    bool success = _writeVerified(_pendingAddresses, _pendingData, count, NB_RETRIES_WRITE);
+    _verifyingWrites = false;
+
+    if (!success)
+        _verifiedWriteStatus = BAD_CRC;
+}
+
+/* Send count writes back-to-back and check that ADDRESS_IFCNT advanced by count (modulo 256).
+ * On a mismatch, bisect : each half is resent and verified on its own. Rewriting a register
+ * that was already written is harmless. */
+bool TMC5160_UART_Generic::_writeVerified(const uint8_t *addresses, const uint32_t *data, uint8_t count,
+                                          uint8_t retries)
+{
+    {
+        Batch burst(*this);
+        for (uint8_t i = 0; i < count; i++)
+            _writeReg(addresses[i], data[i]);
+    }
+    _writeAttemptsCounter += count;
+
+    ReadStatus readStatus;
+    uint8_t counter = readRegister(ADDRESS_IFCNT, &readStatus) & 0xFF; // Flushes the burst first
+
+    bool success = false;
+    if (readStatus == SUCCESS)
+    {
+        success = (uint8_t)(counter - _transmissionCounter) == count;
+        _transmissionCounter = counter;
+
+        if (!success)
+            _recordOutcome(false);
+    }
+
+    if (success)
+    {
+        _writeSuccessfulCounter += count;
+        for (uint8_t i = 0; i < count; i++)
+            _registerWritten(addresses[i], data[i]);
+        return true;
+    }
+
+    TMC5160_STATS(_stats.retries++);
+
+    if (count > 1)
+    {
+        uint8_t half = count / 2;
+        bool first = _writeVerified(addresses, data, half, retries);
+        bool second = _writeVerified(addresses + half, data + half, count - half, retries);
+        return first && second;
+    }
+
+    if (retries > 1)
+        return _writeVerified(addresses, data, 1, retries - 1);
+
+    _registerWriteFailed(addresses[0]);
+    return false;
+}
+
 void TMC5160_UART_Generic::resetCommunication()
 {
-    // FIXME should take into account the previous baud rate !
-    //  For now let's wait 1ms. The spec asks for ~75 bit times so this should be OK for baud rates > 75kbps
+    // The spec asks for ~75 bit times (see _updateTiming).
     //  as of now (09/2018) delay() is broken for small durations on ESP32. Use delayMicroseconds instead
-    delayMicroseconds(1000);
+    delayMicroseconds(_resetTime);
 
 #ifdef SERIAL_DEBUG
     Serial.println("Resetting communication.");
@@ -684,13 +1814,107 @@ void TMC5160_UART_Generic::setSlaveAddress(uint8_t slaveAddress, bool NAI)
     writeRegister(ADDRESS_SLAVECONF, slaveConf.bytes);
 
     _slaveAddress = NAI ? slaveConf.slaveaddr + 1 : slaveConf.slaveaddr;
+    _nai = NAI;
+    _sendDelay = slaveConf.senddelay;
+    _updateTiming();
+    TMC5160_TRACE(_trace.setSource(TMC5160_Trace::TRANSPORT_UART, _slaveAddress, _baudRate));
+}
+
+void TMC5160_UART_Generic::setSendDelay(uint8_t sendDelay)
+{
+    // SLAVECONF is write only : keep the address the chip answers to, whatever the shadow holds
+    SLAVECONF_Register slaveConf = {0};
+    slaveConf.slaveaddr = _nai && _slaveAddress > 0 ? _slaveAddress - 1 : _slaveAddress;
+    slaveConf.senddelay = constrain(sendDelay, 0, 15);
+
+    writeRegister(ADDRESS_SLAVECONF, slaveConf.bytes);
+
+    _sendDelay = slaveConf.senddelay;
+    _updateTiming();
+}
+
+void TMC5160_UART_Generic::setBaudRate(uint32_t baudRate)
+{
+    _baudRate = baudRate;
+    _updateTiming();
+    TMC5160_TRACE(_trace.setSource(TMC5160_Trace::TRANSPORT_UART, _slaveAddress, _baudRate));
+}
+
+unsigned long TMC5160_UART_Generic::_bitsToMicros(uint32_t bits) const
+{
+    return (bits * 1000000ul + _baudRate - 1) / _baudRate;
+}
+
+void TMC5160_UART_Generic::_updateTiming()
+{
+    if (_baudRate == 0) {
+        _interFrameGap = DEFAULT_INTERFRAME_GAP << _gapShift;
+        _resetTime = DEFAULT_RESET_TIME;
+        _replyTimeout = DEFAULT_REPLY_TIMEOUT;
+        return;
+    }
+
+    // SENDDELAY : 0, 1 : 8 bit times ; 2, 3 : 3*8 bit times ; ... 14, 15 : 15*8 bit times
+    uint32_t sendDelayBits = 8 * (_sendDelay | 1);
+
+    _interFrameGap = _bitsToMicros(INTERFRAME_GAP_BITS) << _gapShift; // Longer while adaptive mode backs off
+    _resetTime = _bitsToMicros(RESET_BITS);
+    _replyTimeout = _bitsToMicros((REQUEST_BITS + sendDelayBits + REPLY_BITS) * 3 / 2) + TIMING_SLACK;
+}
+
+bool TMC5160_UART_Generic::calibrateTiming()
+{
+    _waitAsyncIdle();
+
+    // Measure with a generous timeout, whatever the current setting
+    unsigned long configuredTimeout = _replyTimeout;
+    _replyTimeout = (configuredTimeout > DEFAULT_REPLY_TIMEOUT ? configuredTimeout : DEFAULT_REPLY_TIMEOUT) * 4;
+
+    unsigned long longestTurnaround = 0;
+    uint8_t replies = 0;
+
+    for (uint8_t i = 0; i < CALIBRATION_READS; i++) {
+        ReadStatus status;
+        unsigned long startTime = micros();
+        _readReg(ADDRESS_IFCNT, &status);
+        unsigned long turnaround = micros() - startTime;
+
+        if (status == SUCCESS) {
+            longestTurnaround = max(longestTurnaround, turnaround);
+            replies++;
+        } else if (status == NO_REPLY) {
+            resetCommunication();
+        }
+    }
+
+    if (replies == 0) {
+        _replyTimeout = configuredTimeout;
+        return false;
+    }
+
+    // The measure includes the inter-frame gap spent in beginTransmission()
+    unsigned long turnaround = longestTurnaround > _interFrameGap ? longestTurnaround - _interFrameGap : 0;
+    _replyTimeout = turnaround + turnaround / 2 + TIMING_SLACK;
+    return true;
 }
 
 void TMC5160_UART_Generic::setCommunicationMode(TMC5160_UART_Generic::CommunicationMode mode)
 {
+    _adaptive = mode == ADAPTIVE_MODE;
+    _resetErrorWindow();
+
+    if (_adaptive)
+        mode = STREAMING_MODE;
+
+    if (_gapShift != 0) {
+        _gapShift = 0;
+        _updateTiming();
+    }
+
     if (_currentMode == mode)
         return;
 
+    _flushVerifiedWrites();
     _currentMode = mode;
 
     if (mode == RELIABLE_MODE)
@@ -700,6 +1924,103 @@ void TMC5160_UART_Generic::setCommunicationMode(TMC5160_UART_Generic::Communicat
     }
 }
 
+void TMC5160_UART_Generic::setAdaptiveThresholds(uint8_t escalateErrors, uint8_t recoverErrors)
+{
+    if (escalateErrors == 0)
+        escalateErrors = 1;
+    if (escalateErrors > ADAPTIVE_WINDOW)
+        escalateErrors = ADAPTIVE_WINDOW;
+    if (recoverErrors >= escalateErrors)
+        recoverErrors = escalateErrors - 1; // Keep some hysteresis
+
+    _escalateErrors = escalateErrors;
+    _recoverErrors = recoverErrors;
+}
+
+float TMC5160_UART_Generic::getErrorRate() const
+{
+    if (_windowFill == 0)
+        return 0;
+
+    return (float)_windowErrors / (float)_windowFill;
+}
+
+void TMC5160_UART_Generic::_resetErrorWindow()
+{
+    _errorWindow = 0;
+    _windowFill = 0;
+    _windowErrors = 0;
+}
+
+void TMC5160_UART_Generic::_recordOutcome(bool success)
+{
+    if (_windowFill == ADAPTIVE_WINDOW) {
+        if (_errorWindow & (1UL << (ADAPTIVE_WINDOW - 1)))
+            _windowErrors--;
+    } else {
+        _windowFill++;
+    }
+
+    _errorWindow <<= 1;
+    if (!success) {
+        _errorWindow |= 1;
+        _windowErrors++;
+    }
+}
+
+void TMC5160_UART_Generic::_adaptMode()
+{
+    if (!_adaptive)
+        return;
+
+    if (_currentMode == STREAMING_MODE) {
+        if (_windowErrors < _escalateErrors)
+            return;
+
+        _resetErrorWindow();
+        _modeTransitions++;
+        if (_adaptGap) {
+            _gapShift = 1;
+            _updateTiming();
+        }
+
+        _currentMode = RELIABLE_MODE;
+        _transmissionCounter = readRegister(ADDRESS_IFCNT) & 0xFF;
+
+#ifdef SERIAL_DEBUG
+        Serial.println("Adaptive mode : switching to reliable mode.");
+#endif
+        return;
+    }
+
+    // Reliable mode : still failing, back off further
+    if (_windowErrors >= _escalateErrors) {
+        _resetErrorWindow();
+        if (_adaptGap && _gapShift < MAX_GAP_SHIFT) {
+            _gapShift++;
+            _updateTiming();
+        }
+        return;
+    }
+
+    if (_windowFill < ADAPTIVE_WINDOW || _windowErrors > _recoverErrors)
+        return;
+
+    _resetErrorWindow();
+    _modeTransitions++;
+    if (_gapShift != 0) {
+        _gapShift = 0;
+        _updateTiming();
+    }
+
+    _flushVerifiedWrites();
+    _currentMode = STREAMING_MODE;
+
+#ifdef SERIAL_DEBUG
+    Serial.println("Adaptive mode : switching to streaming mode.");
+#endif
+}
+
 void TMC5160_UART_Generic::resetCommunicationSuccessRate()
 {
     _readAttemptsCounter = _readSuccessfulCounter = _writeAttemptsCounter = _writeSuccessfulCounter = 0;
@@ -721,9 +2042,12 @@ float TMC5160_UART_Generic::getWriteSuccessRate()
     return (float)_writeSuccessfulCounter / (float)_writeAttemptsCounter;
 }
 
-uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
+void TMC5160_UART_Generic::_sendReadRequest(uint8_t address)
 {
-    uint8_t outBuffer[4], inBuffer[8];
+    uint8_t outBuffer[4];
+
+    // Queued writes must reach the chip before the read request
+    _flushBatch();
 
     outBuffer[0] = SYNC_BYTE;
     outBuffer[1] = _slaveAddress;
@@ -732,43 +2056,55 @@ uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
     computeCrc(outBuffer, 4);
 
     uartFlushInput();
+    _rxLength = 0;
 
-    beginTransmission();
-    uartWriteBytes(outBuffer, 4);
-    endTransmission();
+    _sendBytes(outBuffer, 4);
 
     _readAttemptsCounter++;
+}
 
-    unsigned long startTime = micros();
-    uint8_t rxLen = 0;
-    while (micros() - startTime < 1000 &&
-           rxLen < 8) // Timeout : 1ms TODO depends on the baudrate and the SENDDELAY parameter
-    {
-        if (uartBytesAvailable() > 0)
-        {
-            inBuffer[rxLen++] = uartReadByte();
-            // Discard the first bytes if necessary
-            if (rxLen == 1 && inBuffer[0] != SYNC_BYTE)
-                rxLen = 0;
-        }
-    }
+bool TMC5160_UART_Generic::_receiveByte(uint8_t byte)
+{
+    TMC5160_STATS(_stats.bytesReceived++);
+
+    if (_rxLength >= 8)
+        return true;
+
+    // Discard the first bytes if necessary
+    if (_rxLength == 0 && byte != SYNC_BYTE)
+        return false;
+
+    // CRC updated as bytes arrive : the reply is checked as soon as the last byte lands
+    if (_rxLength == 0)
+        _rxCrc = _crcUpdate(0, byte);
+    else if (_rxLength < 7)
+        _rxCrc = _crcUpdate(_rxCrc, byte);
+
+    _rxBuffer[_rxLength] = byte;
+    _rxLength = _rxLength + 1;
 
-    if (rxLen < 8)
+    return _rxLength == 8;
+}
+
+uint32_t TMC5160_UART_Generic::_decodeReply(uint8_t address, ReadStatus *status)
+{
+    if (_rxLength < 8)
     {
         if (status != nullptr)
             *status = NO_REPLY;
+        _recordOutcome(false);
 
 #ifdef SERIAL_PRINT_ERRORS
         Serial.print("Read 0x");
         Serial.print(address, HEX);
         Serial.print(": No reply (");
-        Serial.print(rxLen);
+        Serial.print(_rxLength);
         Serial.println(" bytes read)");
         Serial.print("{");
         for (int i = 0; i < 8; i++)
         {
             Serial.print("0x");
-            Serial.print(inBuffer[i], HEX);
+            Serial.print(_rxBuffer[i], HEX);
             Serial.print(" ");
         }
         Serial.println("}");
@@ -777,10 +2113,11 @@ uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
         return 0xFFFFFFFF;
     }
 
-    if (inBuffer[0] != SYNC_BYTE || inBuffer[1] != MASTER_ADDRESS || inBuffer[2] != address)
+    if (_rxBuffer[0] != SYNC_BYTE || _rxBuffer[1] != MASTER_ADDRESS || _rxBuffer[2] != address)
     {
         if (status != nullptr)
             *status = INVALID_FORMAT;
+        _recordOutcome(false);
 
 #ifdef SERIAL_PRINT_ERRORS
         Serial.print("Read 0x");
@@ -790,7 +2127,7 @@ uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
         for (int i = 0; i < 8; i++)
         {
             Serial.print("0x");
-            Serial.print(inBuffer[i], HEX);
+            Serial.print(_rxBuffer[i], HEX);
             Serial.print(" ");
         }
         Serial.println("}");
@@ -801,13 +2138,11 @@ uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
         return 0xFFFFFFFF;
     }
 
-    uint8_t receivedCrc = inBuffer[7];
-    computeCrc(inBuffer, 8);
-
-    if (receivedCrc != inBuffer[7])
+    if (_crcFinal(_rxCrc) != _rxBuffer[7])
     {
         if (status != nullptr)
             *status = BAD_CRC;
+        _recordOutcome(false);
 
 #ifdef SERIAL_PRINT_ERRORS
         Serial.print("Read 0x");
@@ -820,7 +2155,7 @@ uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
 
     uint32_t data = 0;
     for (int i = 0; i < 4; i++)
-        data += ((uint32_t)inBuffer[3 + i] << ((3 - i) * 8));
+        data += ((uint32_t)_rxBuffer[3 + i] << ((3 - i) * 8));
 
 #ifdef SERIAL_DEBUG
     Serial.print("Read 0x");
@@ -830,6 +2165,7 @@ uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
 #endif
 
     _readSuccessfulCounter++;
+    _recordOutcome(true);
 
     if (status != nullptr)
         *status = SUCCESS;
@@ -837,6 +2173,255 @@ uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
     return data;
 }
 
+uint32_t TMC5160_UART_Generic::_readReg(uint8_t address, ReadStatus *status)
+{
+    TMC5160_TRACE(unsigned long requestTime = micros());
+    _sendReadRequest(address);
+
+    unsigned long startTime = micros();
+    while (micros() - startTime < _replyTimeout)
+    {
+        if (uartBytesAvailable() > 0 && _receiveByte(uartReadByte()))
+            break;
+    }
+
+    TMC5160_STATS(_stats.busTime += micros() - startTime);
+
+    ReadStatus readStatus;
+    uint32_t data = _decodeReply(address, &readStatus);
+    TMC5160_TRACE(_trace.record(address, data, readStatus, requestTime));
+
+    if (status != nullptr)
+        *status = readStatus;
+
+    return data;
+}
+
+bool TMC5160_UART_Generic::submitRead(uint8_t address, AsyncCallback callback, void *context)
+{
+    return _submit(address, false, 0, callback, context);
+}
+
+bool TMC5160_UART_Generic::submitWrite(uint8_t address, uint32_t data, AsyncCallback callback, void *context)
+{
+    if (_isRedundantWrite(address, data)) {
+        if (callback != nullptr)
+            callback(context, data, SUCCESS);
+        return true;
+    }
+
+    return _submit(address, true, data, callback, context);
+}
+
+bool TMC5160_UART_Generic::_submit(uint8_t address, bool write, uint32_t data, AsyncCallback callback,
+                                   void *context)
+{
+    if (_asyncCount >= ASYNC_QUEUE_LENGTH)
+        return false;
+
+    AsyncRequest &request = _asyncQueue[(_asyncHead + _asyncCount) % ASYNC_QUEUE_LENGTH];
+    request.address = address;
+    request.write = write;
+    request.data = data;
+    request.callback = callback;
+    request.context = context;
+    _asyncCount++;
+
+    // On a shared bus, the bus decides when the request goes out
+    if (_bus != nullptr)
+        _bus->poll();
+    else if (!_asyncWaitingReply)
+        _startNextRequest();
+
+    return true;
+}
+
+void TMC5160_UART_Generic::_startNextRequest()
+{
+    _sendQueuedWrites();
+
+    if (_asyncCount > 0 && !_asyncWaitingReply)
+        _sendHeadRead();
+}
+
+void TMC5160_UART_Generic::_sendQueuedWrites()
+{
+    // Writes need no reply and complete right away, stop at the first read
+    while (_hasQueuedWrite() && !_asyncWaitingReply) {
+        AsyncRequest &request = _asyncQueue[_asyncHead];
+
+        _writeReg(request.address, request.data);
+        _transmissionCounter++;  // Counted in IFCNT : keeps the next reliable mode check in step
+        _registerWritten(request.address, request.data);
+        TMC5160_STATS(_stats.recordAccess(request.address, true, 0));
+
+        if (_bus != nullptr)
+            _bus->_record(this, true, true, 0);
+
+        _completeRequest(request.data, SUCCESS);
+    }
+}
+
+void TMC5160_UART_Generic::_sendHeadRead()
+{
+    _sendReadRequest(_asyncQueue[_asyncHead].address);
+    _asyncStartTime = micros();
+    _asyncWaitingReply = true;
+}
+
+bool TMC5160_UART_Generic::_pollReply()
+{
+    while (_rxLength < 8 && uartBytesAvailable() > 0)
+        _receiveByte(uartReadByte());
+
+    unsigned long latency = micros() - _asyncStartTime;
+    if (_rxLength < 8 && latency < _replyTimeout)
+        return false;
+
+    ReadStatus status;
+    uint32_t data = _decodeReply(_asyncQueue[_asyncHead].address, &status);
+    TMC5160_TRACE(_trace.record(_asyncQueue[_asyncHead].address, data, status, _asyncStartTime));
+
+    TMC5160_STATS(_stats.recordAccess(_asyncQueue[_asyncHead].address, false, latency);
+                  _stats.busTime += latency);
+
+    if (_bus != nullptr)
+        _bus->_record(this, false, status == SUCCESS, latency);
+
+    _completeRequest(data, status);
+    return true;
+}
+
+void TMC5160_UART_Generic::_completeRequest(uint32_t data, ReadStatus status)
+{
+    AsyncRequest &request = _asyncQueue[_asyncHead];
+    AsyncCallback callback = request.callback;
+    void *context = request.context;
+
+    _asyncHead = (_asyncHead + 1) % ASYNC_QUEUE_LENGTH;
+    _asyncCount--;
+    _asyncWaitingReply = false;
+
+    if (callback != nullptr)
+        callback(context, data, status);
+}
+
+void TMC5160_UART_Generic::onByte(uint8_t byte)
+{
+    if (_asyncWaitingReply)
+        _receiveByte(byte);
+}
+
+void TMC5160_UART_Generic::poll()
+{
+    if (_bus != nullptr) {
+        _bus->poll();
+        return;
+    }
+
+    if (_asyncWaitingReply && !_pollReply())
+        return;
+
+    _startNextRequest();
+}
+
+void TMC5160_UART_Generic::_waitAsyncIdle()
+{
+    while (_asyncCount != 0)
+        poll();
+
+    if (_bus != nullptr)
+        _bus->_waitIdle();
+}
+
+
+
+
+TMC5160_UART_Bus::TMC5160_UART_Bus() : _slaveCount(0), _nextSlave(0), _owner(nullptr)
+{
+    resetStatistics();
+}
+
+bool TMC5160_UART_Bus::attach(TMC5160_UART_Generic &driver)
+{
+    if (_slaveCount >= MAX_SLAVES)
+        return false;
+
+    driver._waitAsyncIdle();
+    driver._bus = this;
+    _slaves[_slaveCount++] = &driver;
+    return true;
+}
+
+void TMC5160_UART_Bus::poll()
+{
+    if (_owner != nullptr) {
+        if (!_owner->_pollReply())
+            return;
+
+        _owner = nullptr;
+    }
+
+    // Writes of all the slaves first : they need no reply
+    for (uint8_t i = 0; i < _slaveCount; i++)
+        _slaves[i]->_sendQueuedWrites();
+
+    // Then the next read, round-robin
+    for (uint8_t i = 0; i < _slaveCount; i++) {
+        TMC5160_UART_Generic *slave = _slaves[(_nextSlave + i) % _slaveCount];
+
+        if (slave->_asyncCount > 0) {
+            slave->_sendHeadRead();
+            _owner = slave;
+            _nextSlave = (_nextSlave + i + 1) % _slaveCount;
+            break;
+        }
+    }
+}
+
+void TMC5160_UART_Bus::_waitIdle()
+{
+    while (_owner != nullptr)
+        poll();
+}
+
+void TMC5160_UART_Bus::_record(TMC5160_UART_Generic *driver, bool write, bool success, unsigned long latency)
+{
+    for (uint8_t i = 0; i < _slaveCount; i++) {
+        if (_slaves[i] != driver)
+            continue;
+
+        SlaveStatistics &statistics = _statistics[i];
+        if (write) {
+            statistics.writes++;
+        } else {
+            statistics.reads++;
+            if (!success)
+                statistics.errors++;
+
+            statistics.lastLatency = latency;
+            statistics.totalLatency += latency;
+            if (latency > statistics.maxLatency)
+                statistics.maxLatency = latency;
+        }
+        return;
+    }
+}
+
+float TMC5160_UART_Bus::getAverageLatency(uint8_t slave) const
+{
+    const SlaveStatistics &statistics = _statistics[slave];
+    if (statistics.reads == 0)
+        return 0;
+
+    return (float)statistics.totalLatency / (float)statistics.reads;
+}
+
+void TMC5160_UART_Bus::resetStatistics()
+{
+    memset(_statistics, 0, sizeof(_statistics));
+}
+
 void TMC5160_UART_Generic::_writeReg(uint8_t address, uint32_t data)
 {
 #ifdef SERIAL_DEBUG
@@ -854,6 +2439,7 @@ void TMC5160_UART_Generic::_writeReg(uint8_t address, uint32_t data)
         buffer[3 + i] = (data & (0xFFul << ((3 - i) * 8))) >> ((3 - i) * 8);
 
     computeCrc(buffer, 8);
+    TMC5160_TRACE(unsigned long startTime = micros());
 
 #if 0
 	//Intentional interference to test the reliable mode : change the CRC
@@ -861,32 +2447,74 @@ void TMC5160_UART_Generic::_writeReg(uint8_t address, uint32_t data)
 		buffer[7]++;
 #endif
 
+    if (isBatching()) {
+        if ((size_t)_batchLength + 8 > sizeof(_batchBuffer))
+            _flushBatch();
+
+        memcpy(_batchBuffer + _batchLength, buffer, 8);
+        _batchLength += 8;
+        TMC5160_TRACE(_trace.record(address | WRITE_ACCESS, data, SUCCESS, startTime));  // Sent with the batch
+        return;
+    }
+
+    _sendBytes(buffer, 8);
+    TMC5160_TRACE(_trace.record(address | WRITE_ACCESS, data, SUCCESS, startTime));
+}
+
+bool TMC5160_UART_Generic::_readRegisterChecked(uint8_t address, uint32_t *value)
+{
+    ReadStatus status;
+    *value = readRegister(address, &status);
+    return status == SUCCESS;
+}
+
+void TMC5160_UART_Generic::_onBatchBegin()
+{
+    // Only a user batch starts a new outcome : a flush at its end must not hide earlier failures
+    if (!_verifyingWrites)
+        _verifiedWriteStatus = SUCCESS;
+}
+
+void TMC5160_UART_Generic::_onBatchEnd()
+{
+    _flushVerifiedWrites();
+    _flushBatch();
+}
+
+void TMC5160_UART_Generic::_flushBatch()
+{
+    if (_batchLength == 0)
+        return;
+
+    _sendBytes(_batchBuffer, _batchLength);
+    _batchLength = 0;
+}
+
+void TMC5160_UART_Generic::_sendBytes(const uint8_t *buffer, uint8_t length)
+{
+    TMC5160_STATS(unsigned long startTime = micros());
+
     beginTransmission();
-    uartWriteBytes(buffer, 8);
+    uartWriteBytes(buffer, length);
     endTransmission();
+
+    TMC5160_STATS(_stats.bytesSent += length;
+                  _stats.busTime += micros() - startTime);
 }
 
 /* From Trinamic TMC5130A datasheet Rev. 1.14 / 2017-MAY-15 §5.2 */
-void TMC5160_UART_Generic::computeCrc(uint8_t *datagram, uint8_t datagramLength)
+uint8_t TMC5160_UART_Generic::crc8(const uint8_t *data, uint8_t length)
 {
-    int i, j;
-    uint8_t *crc = datagram + (datagramLength - 1);
-    uint8_t currentByte;
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; i++)
+        crc = _crcUpdate(crc, data[i]);
 
-    *crc = 0;
-    for (i = 0; i < (datagramLength - 1); i++)
-    {
-        currentByte = datagram[i];
-        for (j = 0; j < 8; j++)
-        {
-            if ((*crc >> 7) ^ (currentByte & 0x01))
-                *crc = (*crc << 1) ^ 0x07;
-            else
-                *crc = (*crc << 1);
+    return _crcFinal(crc);
+}
 
-            currentByte = currentByte >> 1;
-        }
-    }
+void TMC5160_UART_Generic::computeCrc(uint8_t *datagram, uint8_t datagramLength)
+{
+    datagram[datagramLength - 1] = crc8(datagram, datagramLength - 1);
 }
 
 // void TMC5160_UART_Generic::computeCrc(uint8_t *datagram, uint8_t datagramLength) {
@@ -27,6 +27,114 @@ enum DriverStatus
     OTPW       // Overtemperature pre warning
 };
 
+/* Optional transfer instrumentation.
+ * Build with TMC5160_ENABLE_STATS defined (in the compiler flags, so that the library sources see
+ * it too) to record per-register access counts, access latency histograms, bytes on the wire and
+ * retries. Without it nothing is stored nor recorded. */
+#ifdef TMC5160_ENABLE_STATS
+#define TMC5160_STATS(...) __VA_ARGS__
+#else
+#define TMC5160_STATS(...)
+#endif
+
+#ifdef TMC5160_ENABLE_STATS
+struct TMC5160_TransferStats
+{
+    /* Latency buckets : 0 us, then [2^(n-1), 2^n) us for bucket n ; the last one also holds longer accesses */
+    static constexpr uint8_t LATENCY_BUCKETS = 16;
+
+    uint16_t reads[REGISTER_ADDRESS_COUNT];   // Per register address
+    uint16_t writes[REGISTER_ADDRESS_COUNT];
+    uint32_t readLatency[LATENCY_BUCKETS];    // readRegister() / writeRegister() duration, retries included
+    uint32_t writeLatency[LATENCY_BUCKETS];
+    uint32_t bytesSent;
+    uint32_t bytesReceived;
+    uint32_t retries;
+    uint32_t busTime;                         // us spent transferring or waiting for a reply
+
+    void reset();
+    void recordAccess(uint8_t address, bool write, unsigned long latency);
+    static uint8_t latencyBucket(unsigned long latency);
+
+    /* Compact text export, one line per item :
+     *   bytes <sent> <received> retries <n> bus_us <t>
+     *   r <address> <count>   /   w <address> <count>    (non zero only)
+     *   lat_r <16 bucket counts>   /   lat_w <16 bucket counts> */
+    void print(Print &out) const;
+};
+#endif
+
+/* Optional bus trace.
+ * Build with TMC5160_ENABLE_TRACE defined to have every transport record each datagram it
+ * exchanges with the chip (UART : each read request / reply and write datagram, retries
+ * included) in a ring buffer of TMC5160_TRACE_LENGTH records held by the driver object :
+ * no heap, no prints. dump() writes them in a binary format that extras/host/tools decodes and
+ * replays against the emulated chip. */
+#ifdef TMC5160_ENABLE_TRACE
+#define TMC5160_TRACE(...) __VA_ARGS__
+#else
+#define TMC5160_TRACE(...)
+#endif
+
+#ifndef TMC5160_TRACE_LENGTH
+#define TMC5160_TRACE_LENGTH 32
+#endif
+
+struct TMC5160_TraceRecord
+{
+    uint32_t timestamp;  // micros() when the datagram was sent
+    uint32_t data;       // Data written, or data received
+    uint8_t address;     // Register address, 0x80 set for writes
+    uint8_t status;      // SPI : status byte received ; UART : ReadStatus of a read, SUCCESS for a write
+    uint16_t duration;   // us until the end of the transfer or the reply, saturated
+};
+
+class TMC5160_Trace
+{
+  public:
+    enum Transport : uint8_t {
+        TRANSPORT_SPI = 1,
+        TRANSPORT_SPI_CHAIN = 2,  // Node : chain slot
+        TRANSPORT_UART = 3        // Node : slave address
+    };
+
+    /* Dump layout, little endian : a header of DUMP_HEADER_LENGTH bytes, then the records
+     * (RECORD_LENGTH bytes each, fields in declaration order), oldest first.
+     *   0 magic "TMCT"   4 version   5 transport   6 node   7 record length
+     *   8 UART baud rate (0 for SPI)   12 records traced since clear()   16 records dumped   18 0 */
+    static constexpr uint32_t DUMP_MAGIC = 0x54434D54;
+    static constexpr uint8_t DUMP_VERSION = 1;
+    static constexpr uint8_t DUMP_HEADER_LENGTH = 20;
+    static constexpr uint8_t RECORD_LENGTH = 12;
+
+    TMC5160_Trace();
+
+    void setSource(Transport transport, uint8_t node, uint32_t baudRate = 0);
+    void clear();
+    void freeze(bool frozen) { _frozen = frozen; }  // Stop recording, e.g. to keep the datagrams leading to a fault
+    bool isFrozen() const { return _frozen; }
+
+    uint16_t getCount() const { return _count; }
+    uint32_t getTotal() const { return _total; }  // Records since clear() : the oldest ones are overwritten
+    const TMC5160_TraceRecord &getRecord(uint16_t index) const;  // 0 : oldest
+
+    void record(uint8_t address, uint32_t data, uint8_t status, unsigned long startTime);
+    size_t dump(Print &out) const;
+
+  private:
+    TMC5160_TraceRecord _records[TMC5160_TRACE_LENGTH];
+    uint16_t _head;  // Next record written
+    uint16_t _count;
+    uint32_t _total;
+    bool _frozen;
+
+    Transport _transport;
+    uint8_t _node;
+    uint32_t _baudRate;
+
+    static size_t _write(Print &out, uint32_t value, uint8_t length);
+};
+
 class TMC5160
 {
   public:
@@ -38,7 +146,60 @@ class TMC5160
     virtual uint32_t readRegister(uint8_t address) = 0;  // addresses are from TMC5160.h
     virtual uint8_t writeRegister(uint8_t address, uint32_t data) = 0;
 
+    /* Batched register access scope :
+     *     {
+     *         TMC5160::Batch batch(motor);
+     *         motor.setRampSpeeds(...);
+     *         motor.setAccelerations(...);
+     *     }
+     * Register accesses made while a Batch is alive are emitted as one tight burst : SPI keeps
+     * the bus claimed and only pulses CS between datagrams, UART concatenates the write datagrams
+     * (a read flushes them first). Scopes may be nested, the burst ends with the outermost one. */
+    class Batch
+    {
+      public:
+        explicit Batch(TMC5160 &driver) : _driver(driver) { _driver._beginBatch(); }
+        ~Batch() { _driver._endBatch(); }
+
+      private:
+        TMC5160 &_driver;
+
+        Batch(const Batch &) = delete;
+        Batch &operator=(const Batch &) = delete;
+    };
+
+    bool isBatching() const { return _batchDepth != 0; }
+
+    static uint8_t getRegisterAccess(uint8_t address);  // REG_READ / REG_WRITE / REG_CLEAR / REG_VOLATILE flags
+
+    /* Shadow register file.
+     * Every register write goes through the shadow, so configuration fields can be modified
+     * without reading the chip back. Write-only registers are known once written ; readable ones
+     * are read once on first use. setShadowRegister() only updates the shadow and marks the
+     * register dirty, flush() then writes the dirty registers. */
+    static constexpr uint8_t SHADOW_REGISTER_COUNT = 46;  // Writable registers which are not R+WC
+    bool isShadowValid(uint8_t address);
+    bool isShadowDirty(uint8_t address);
+    uint32_t getShadowRegister(uint8_t address);   // Last known value, 0 if unknown
+    uint32_t readShadowRegister(uint8_t address);  // Shadow value, read from the chip if unknown
+    void setShadowRegister(uint8_t address, uint32_t data);
+    void flush();
+    void invalidateShadow();
+
+    /* Redundant write suppression (disabled by default).
+     * When enabled, a write whose value matches the shadow of a register known to hold it is
+     * skipped. Registers changed by the chip and R+WC registers are always written. The shadow
+     * is invalidated when a reset is detected (ADDRESS_GSTAT reset flag, SPI status reset_flag),
+     * dirty values and writes pending in a Batch included : they belong to a configuration the
+     * chip lost. A reset seen by any transfer is latched for isResetOccurred(), which stays the
+     * way to learn about it (then call begin() and configure again). */
+    void setRedundantWriteSuppression(bool enabled) { _suppressRedundantWrites = enabled; }
+    uint32_t getSkippedWriteCount() const { return _skippedWriteCounter; }
+    uint32_t getIssuedWriteCount() const { return _issuedWriteCounter; }
+    void resetWriteCounters() { _skippedWriteCounter = _issuedWriteCounter = 0; }
+
     void setRampMode(RampMode mode);  //Doxygen
+    RampMode getRampMode() const { return _currentRampMode; }
     float getCurrentPosition();  // Return the current internal position (steps)
     float getEncoderPosition();  // Return the current position according to the encoder counter (steps)
     float getLatchedPosition();  // Return the position that was latched on the last ref switch / encoder event (steps)
@@ -51,14 +212,51 @@ class TMC5160
     void setCurrentPosition(float position, bool updateEncoderPos = false);
     // update the encoder counter as well to keep them in sync.
     void setTargetPosition(float position);
+
+    /* Positions in microsteps, without float rounding (a float is exact up to 2^24 microsteps).
+     * The register itself is read : two datagrams on SPI, whose reads are pipelined. */
+    int32_t getCurrentPositionMicrosteps() { return _readRegisterExact(ADDRESS_XACTUAL); }
+    int32_t getEncoderPositionMicrosteps() { return _readRegisterExact(ADDRESS_X_ENC); }
+    int32_t getTargetPositionMicrosteps() { return _readRegisterExact(ADDRESS_XTARGET); }
+    void setCurrentPositionMicrosteps(int32_t position, bool updateEncoderPos = false);
+    void setTargetPositionMicrosteps(int32_t position) { writeRegister(ADDRESS_XTARGET, position); }
+
+    /* Multi-turn positions in microsteps : 64-bit counts following XACTUAL / X_ENC across the
+     * 32-bit wraparound. Each read adds the register change since the previous one, so read them at
+     * least once per 2^31 microsteps of travel. A failed read (detected on UART) returns the previous value.
+     * Writing XACTUAL / X_ENC through any other function restarts the count from the value written.
+     * The target must lie within 2^31 microsteps of the current position : the chip moves the
+     * shortest way around the 32-bit register. */
+    int64_t getExtendedPosition() { return _readExtendedPosition(ADDRESS_XACTUAL, _extendedPosition); }
+    int64_t getExtendedEncoderPosition() { return _readExtendedPosition(ADDRESS_X_ENC, _extendedEncoderPosition); }
+    void setExtendedPosition(int64_t position, bool updateEncoderPos = false);
+    void setExtendedTargetPosition(int64_t position) { writeRegister(ADDRESS_XTARGET, (uint32_t)position); }
     void moveAtVelocity(float speed);  // Set the max speed ADDRESS_VMAX (steps/second)
     // Set the ramp start speed ADDRESS_VSTART, ramp stop speed ADDRESS_VSTOP, acceleration transition speed
     void setRampSpeeds(float startSpeed, float stopSpeed, float transitionSpeed);
     void setAcceleration(float maxAccel);  // Set the ramp acceleration / deceleration (steps / second^2)
+
+    /* Integer fast path for streaming loops, in chip units : no float maths.
+     * moveAtVelocityRaw() takes a signed VMAX (the sign selects the direction in velocity mode),
+     * setAccelerationRaw() an AMAX value. speedFromMicrosteps() and accelFromMicrosteps() convert
+     * microsteps / second (and / second^2) with one multiply and shift, rounded to nearest. */
+    void moveAtVelocityRaw(int32_t vmax);
+    void setAccelerationRaw(uint32_t amax);
+    int32_t speedFromMicrosteps(int32_t microstepsPerSecond) const;
+    uint32_t accelFromMicrosteps(uint32_t microstepsPerSecond2) const;
+
+    /* Clock frequency of the chip, DEFAULT_F_CLK for the internal oscillator. Set it after
+     * switching to an external clock : the unit conversions use it. */
+    void setClockFrequency(uint32_t fclk);
+    uint32_t getClockFrequency() const { return _fclk; }
+
+    /* Microsteps per full step of the float positions, speeds and accelerations : _uStepCount,
+     * or the USTEPS of TMC5160T, which sets CHOPCONF.mres to match. */
+    uint16_t getMicrostepsPerStep() const { return _uSteps; }
     void setAccelerations(float maxAccel, float startAccel, float maxDecel, float finalDecel);
 
-    bool isTargetPositionReached(void);  // Return true if the target position has been reached
-    bool isTargetVelocityReached(void);  // Return true if the target velocity has been reached
+    virtual bool isTargetPositionReached(void);  // Return true if the target position has been reached
+    virtual bool isTargetVelocityReached(void);  // Return true if the target velocity has been reached
 
     void earlyRampTermination();  // Stop the current motion according to the set ramp mode and motion parameters. The max
 
@@ -66,7 +264,8 @@ class TMC5160
     void enable();
     void disable();
 
-    bool isResetOccurred();
+    virtual bool isResetOccurred();  // Since the last call or begin(), even if GSTAT was cleared since
+    virtual bool isStallDetected();  // Return true if stallGuard2 reports a motor stall
     DriverStatus getDriverStatus();                      // Get the current driver status (OK / error conditions)
     void printDriverStatusDescription(DriverStatus st);  ///< print human readalbe desccription
     void setModeChangeSpeeds(float pwmThrs, float coolThrs, float highThrs);
@@ -87,12 +286,134 @@ class TMC5160
     void setCurrentMilliamps(uint16_t Irms);
     void setMicrosteps(uint8_t microsteps);
 
+#ifdef TMC5160_ENABLE_STATS
+    /* Transfer statistics. Copy the structure to take a snapshot. */
+    const TMC5160_TransferStats &getTransferStats() const { return _stats; }
+    void resetTransferStats() { _stats.reset(); }
+#endif
+
+#ifdef TMC5160_ENABLE_TRACE
+    /* Bus trace, freeze() it on a fault then dump() it */
+    TMC5160_Trace &getTrace() { return _trace; }
+    const TMC5160_Trace &getTrace() const { return _trace; }
+#endif
+
   protected:
+    friend class TMC5160_Events;     // Exact reads of the event registers
+    friend class TMC5160_MoveQueue;  // Checked reads of the ramp status
+
+    void setMicrostepsPerStep(uint16_t uSteps);  // Sets chopConf.mres to match, written by begin()
+
     static constexpr uint8_t WRITE_ACCESS = 0x80;  // Register write access for spi / uart communication
 
+    /* Transports call this when a reply reports a reset : invalidates the shadow, latched for isResetOccurred() */
+    void _resetDetected();
+    bool _takeResetLatch();  // Returns and clears the latch
+
+    /* Transports call this for every register written to the chip. */
+    void _registerWritten(uint8_t address, uint32_t data);
+    void _registerWriteFailed(uint8_t address);  // Register content is unknown after a failed write
+
+    /* Transports call this before writing a register, and skip the write if it returns true. */
+    bool _isRedundantWrite(uint8_t address, uint32_t data);
+
+    /* Transports override these to start / end a burst of register accesses (see Batch). */
+    virtual void _onBatchBegin() {}
+    virtual void _onBatchEnd() {}
+
+    /* Read the value of the addressed register itself. Transports with a pipelined read
+     * (SPI returns the data of the previous access) override this. */
+    virtual uint32_t _readRegisterExact(uint8_t address) { return readRegister(address); }
+
+    /* Same, with the failures reported apart from the value, for registers where any value is
+     * valid. Transports that cannot detect a failed read always return true. */
+    virtual bool _readRegisterChecked(uint8_t address, uint32_t *value)
+    {
+        *value = _readRegisterExact(address);
+        return true;
+    }
+
+#ifdef TMC5160_ENABLE_STATS
+    TMC5160_TransferStats _stats;
+#endif
+#ifdef TMC5160_ENABLE_TRACE
+    TMC5160_Trace _trace;
+#endif
+
+    // Referring to Topic 12.1 on Page 81 of Datasheet Version 1.17 for Real-world Unit Conversions
+    //  v[Hz] = v[5160A] * ( f CLK [Hz]/2 / 2^23 )
+    // The fclk terms are computed by setClockFrequency(). The float conversions keep the operation
+    // order (and double precision for accelerations) of the original expressions : same register
+    // values. The integer ones below are the fast path.
+    float speedToHz(int32_t speedInternal) { return (float)speedInternal * _speedToHzScale; }
+    int32_t speedFromHz(float speedHz) { return (int32_t)(speedHz / _speedUnitHz * (float)_uSteps); }
+
+    // Following §14.1 Real world unit conversions
+    // a[Hz/s] = a[5160A] * f CLK [Hz]^2 / (512*256) / 2^24
+    int32_t accelFromHz(float accelHz) { return (int32_t)(accelHz / _accelUnitHz * (float)_uSteps); }
+    int32_t thrsSpeedToTstep(float thrsSpeed) { return thrsSpeed != 0.0 ? (int32_t)constrain((float)_fclk / (thrsSpeed * 256.0), 0, 1048575) : 0; }
+
   private:
     uint32_t _fclk;
+    uint16_t _uSteps;
+
+    // Unit conversion factors for the current fclk
+    float _speedToHzScale;    // fclk / 2^24 / uSteps, exact : the divisors are powers of two
+    float _speedUnitHz;       // fclk / 2^24
+    double _accelUnitHz;      // fclk^2 / 2^41
+    uint32_t _speedFactor;    // 2^24 / fclk, Q8.24
+    uint32_t _accelFactor;    // 2^41 / fclk^2, Q0.32
+
     RampMode _currentRampMode;
+
+    uint32_t _shadow[SHADOW_REGISTER_COUNT];
+    uint64_t _shadowValid;
+    uint64_t _shadowDirty;
+
+    uint8_t _batchDepth;
+
+    void _beginBatch() { if (_batchDepth++ == 0) _onBatchBegin(); }
+    void _endBatch() { if (--_batchDepth == 0) _onBatchEnd(); }
+
+    bool _suppressRedundantWrites;
+    bool _resetLatched;
+    uint32_t _skippedWriteCounter;
+    uint32_t _issuedWriteCounter;
+
+    static int8_t _shadowIndex(uint8_t address);
+
+    /* 64-bit count following a 32-bit position register */
+    struct ExtendedPosition
+    {
+        int64_t value;
+        uint32_t raw;  // Register value at the last update
+        bool preset;   // value set by setExtendedPosition(), the write in progress keeps it
+
+        int64_t update(uint32_t data)
+        {
+            value += (int32_t)(data - raw);
+            raw = data;
+            return value;
+        }
+
+        void written(uint32_t data)
+        {
+            if (!preset)
+                value = (int32_t)data;
+            raw = data;
+            preset = false;
+        }
+    };
+
+    ExtendedPosition _extendedPosition;
+    ExtendedPosition _extendedEncoderPosition;
+
+    int64_t _readExtendedPosition(uint8_t address, ExtendedPosition &position)
+    {
+        uint32_t data;
+        return _readRegisterChecked(address, &data) ? position.update(data) : position.value;
+    }
+
     
 
     GCONF_Register globalConfig;
@@ -109,20 +430,25 @@ class TMC5160
     COOLCONF_Register coolConf;
     SW_MODE_Register switchMode;
 
-    // Referring to Topic 12.1 on Page 81 of Datasheet Version 1.17 for Real-world Unit Conversions
-    //  v[Hz] = v[5160A] * ( f CLK [Hz]/2 / 2^23 )
-    float speedToHz(int32_t speedInternal) { return ((float)speedInternal * (float)_fclk / (float)(1ul << 24) / (float)_uStepCount); }
-    int32_t speedFromHz(float speedHz) { return (int32_t)(speedHz / ((float)_fclk / (float)(1ul << 24)) * (float)_uStepCount); }
-
-    // Following §14.1 Real world unit conversions
-    // a[Hz/s] = a[5160A] * f CLK [Hz]^2 / (512*256) / 2^24
-    int32_t accelFromHz(float accelHz) { return (int32_t)(accelHz / ((float)_fclk * (float)_fclk / (512.0*256.0) / (float)(1ul<<24)) * (float)_uStepCount); }
-    int32_t thrsSpeedToTstep(float thrsSpeed) { return thrsSpeed != 0.0 ? (int32_t)constrain((float)_fclk / (thrsSpeed * 256.0), 0, 1048575) : 0; }
 };
 
 
 
 
+/* SPI transfer backend :
+ * shifts a contiguous buffer of datagrams in place (received bytes overwrite the transmitted ones)
+ * with the chip select asserted, then calls handler(context). The handler may be called before
+ * startTransfer() returns (blocking backend) or later from an interrupt (DMA backend).
+ */
+class TMC5160_SPI_Backend
+{
+  public:
+    typedef void (*CompletionHandler)(void *context);
+
+    virtual ~TMC5160_SPI_Backend() {}
+    virtual void startTransfer(uint8_t *buffer, size_t length, CompletionHandler handler, void *context) = 0;
+};
+
 /* SPI interface : 
  * the TMC5160 SWSEL input has to be low (default state).
  */
@@ -135,18 +461,175 @@ class TMC5160_SPI : public TMC5160
     uint32_t readRegister(uint8_t address);
     uint8_t writeRegister(uint8_t address, uint32_t data);
 
+    /* Read several registers in one pipelined burst.
+     * The TMC5160 returns the data of a read request in the following datagram, so the
+     * addresses are sent back-to-back and the results collected from frames 2..count+1.
+     * This costs count+1 datagrams instead of 2*count for individual reads. */
+    void readRegisters(const uint8_t *addresses, uint32_t *values, size_t count);
+
+    /* Status byte received with the last datagram, and the micros() time it was received at.
+     * Every read and write refreshes it, at no extra bus cost. */
+    SPI_STATUS_Register lastSpiStatus() const { return _spiStatus; }
+    unsigned long lastSpiStatusMicros() const { return _spiStatusMicros; }
+
+    /* Answer the status queries below from the last SPI status byte when it is younger than
+     * maxAgeMicros, instead of reading ADDRESS_RAMP_STAT / ADDRESS_GSTAT / ADDRESS_DRV_STATUS.
+     * A set reset flag always falls back to reading ADDRESS_GSTAT so that it gets cleared.
+     * Set to 0 (default) to always read the registers. */
+    void setStatusMaxAge(unsigned long maxAgeMicros) { _statusMaxAge = maxAgeMicros; }
+
+    bool isTargetPositionReached(void);
+    bool isTargetVelocityReached(void);
+    bool isResetOccurred();
+    bool isStallDetected();
+
+    /* Asynchronous register access.
+     * Transactions are queued and handed one by one to the backend ; the callback receives the
+     * data and status byte of the datagram, i.e. the result of the *previous* access as for
+     * readRegister(). With a DMA backend the callback runs in interrupt context.
+     * Callbacks should only submit further transactions : a blocking access made from one
+     * (readRegister(), writeRegister(), Batch...) does not wait for the queue, it goes on the
+     * bus ahead of the queued transactions, from interrupt context with a DMA backend.
+     * Without backend, transactions complete synchronously on the SPIClass given at construction.
+     * submitRead / submitWrite return false if the queue is full. */
+    typedef void (*AsyncCallback)(void *context, uint32_t data, SPI_STATUS_Register status);
+
+    void setBackend(TMC5160_SPI_Backend *backend) { _backend = backend; }
+    bool submitRead(uint8_t address, AsyncCallback callback = nullptr, void *context = nullptr);
+    bool submitWrite(uint8_t address, uint32_t data, AsyncCallback callback = nullptr, void *context = nullptr);
+    uint8_t getPendingTransactions() const { return _asyncCount; }
+    bool isAsyncIdle() const { return _asyncCount == 0; }
+
   private:
+    static constexpr uint8_t PIPELINE_FLUSH_ADDRESS = ADDRESS_GCONF; // Side-effect free register read to clock out the last result
+    static constexpr uint8_t DATAGRAM_LENGTH = 5;
+    static constexpr uint8_t ASYNC_QUEUE_LENGTH = 8;
+
+    struct AsyncTransaction {
+        uint8_t buffer[DATAGRAM_LENGTH];
+        AsyncCallback callback;
+        void *context;
+    };
+
     uint8_t _CS;
     SPISettings _spiSettings;
     SPIClass *_spi;
 
+    SPI_STATUS_Register _spiStatus;
+    unsigned long _spiStatusMicros;
+    unsigned long _statusMaxAge;
+
+    TMC5160_SPI_Backend *_backend;
+    AsyncTransaction _asyncQueue[ASYNC_QUEUE_LENGTH];
+    volatile uint8_t _asyncHead;
+    volatile uint8_t _asyncCount;
+    volatile bool _asyncBusy;
+    volatile bool _asyncInCallback;
+#if defined(TMC5160_ENABLE_STATS) || defined(TMC5160_ENABLE_TRACE)
+    uint8_t _asyncAddress;          // Of the transaction in flight
+    unsigned long _asyncStartMicros;
+#endif
+#ifdef TMC5160_ENABLE_TRACE
+    uint32_t _asyncData;
+#endif
+
+    bool _isStatusFresh();
+    uint32_t _readRegisterExact(uint8_t address);
+
+    bool _busClaimed;  // Bus held for a whole batch
+    void _onBatchBegin();
+    void _onBatchEnd();
+
     void _beginTransaction();
     void _endTransaction();
+    uint32_t _transferDatagram(uint8_t address, uint32_t data, uint8_t *status); // Bus must be claimed
+
+    bool _submit(uint8_t address, uint32_t data, AsyncCallback callback, void *context);
+    void _startNextTransaction();
+    void _waitAsyncIdle();
+    static void _onTransferComplete(void *context);
+};
+
+/* Daisy-chained SPI interface :
+ * several TMC5160 share one chip select, the SDO of each driver feeding the SDI of the next.
+ * Slot 0 is the driver whose SDI is connected to the MCU MOSI, slot length-1 the one whose SDO
+ * is connected to MISO. Every transaction shifts one 40-bit datagram per driver, so all the
+ * drivers of the chain are accessed in a single CS cycle.
+ * Slots without a queued datagram receive a side-effect free read of ADDRESS_GCONF.
+ */
+class TMC5160_SPI_Chain
+{
+  public:
+    static constexpr uint8_t MAX_CHAIN_LENGTH = 8;
+
+    TMC5160_SPI_Chain(uint8_t chipSelectPin, uint8_t length,
+                      const SPISettings &spiSettings = SPISettings(1000000, MSBFIRST, SPI_MODE3), SPIClass &spi = SPI);
+
+    uint8_t getLength() const { return _length; }
+
+    /* Low level access : queue one datagram per slot, then shift them all with transfer().
+     * The replies of the last transfer (data of the previous access of each driver) are
+     * available until the next one. Slots beyond the chain length are ignored. */
+    void queueRead(uint8_t slot, uint8_t address);
+    void queueWrite(uint8_t slot, uint8_t address, uint32_t data);
+    bool isQueued(uint8_t slot) const { return slot < _length && (_queued & (1 << slot)); }
+    void transfer();
+    uint32_t getReplyData(uint8_t slot) const { return slot < _length ? _rxData[slot] : 0; }
+    SPI_STATUS_Register getReplyStatus(uint8_t slot) const { return _rxStatus[slot < _length ? slot : 0]; }
+
+    /* Write the same register on every driver of the chain in a single transaction. */
+    void writeAll(uint8_t address, uint32_t data);
+    void writeAll(uint8_t address, const uint32_t *data);
+    /* Read the same register on every driver of the chain (two transactions). */
+    void readAll(uint8_t address, uint32_t *values);
+
+    /* Between beginUpdate() and endUpdate(), writes made through TMC5160_SPI_ChainDevice are
+     * queued and shifted together : one transaction per register instead of one per register
+     * and driver. A slot that already holds a queued write forces a transfer first. */
+    void beginUpdate() { _updating = true; }
+    void endUpdate();
+    bool isUpdating() const { return _updating; }
+
+  private:
+    static constexpr uint8_t WRITE_ACCESS = 0x80;
+    static constexpr uint8_t NOP_ADDRESS = ADDRESS_GCONF;
+
+    uint8_t _CS;
+    uint8_t _length;
+    SPISettings _spiSettings;
+    SPIClass *_spi;
+    bool _updating;
+
+    uint8_t _queued;
+    uint8_t _txAddress[MAX_CHAIN_LENGTH];
+    uint32_t _txData[MAX_CHAIN_LENGTH];
+    uint32_t _rxData[MAX_CHAIN_LENGTH];
+    SPI_STATUS_Register _rxStatus[MAX_CHAIN_LENGTH];
+};
+
+/* One driver of a TMC5160_SPI_Chain. The slot is clamped to the chain length. */
+class TMC5160_SPI_ChainDevice : public TMC5160
+{
+  public:
+    TMC5160_SPI_ChainDevice(TMC5160_SPI_Chain &chain, uint8_t slot, uint32_t fclk = DEFAULT_F_CLK);
+
+    uint32_t readRegister(uint8_t address);
+    uint8_t writeRegister(uint8_t address, uint32_t data);
+
+    SPI_STATUS_Register lastSpiStatus() const { return _chain->getReplyStatus(_slot); }
+
+  private:
+    TMC5160_SPI_Chain *_chain;
+    uint8_t _slot;
 };
 
+class TMC5160_UART_Bus;
+
 /* Generic UART interface */
 class TMC5160_UART_Generic : public TMC5160
 {
+    friend class TMC5160_UART_Bus;
+
   public:
     /* Read/write register return codes */
     enum ReadStatus {
@@ -159,14 +642,17 @@ class TMC5160_UART_Generic : public TMC5160
     /* Serial communication modes. In reliable mode, register writes are checked and
      * retried if necessary, and register reads are retried multiple times in case
      * of failure. In streaming mode, none of these checks are performed and register
-     * read / writes are tried only once. Default is Streaming mode. */
+     * read / writes are tried only once. Default is Streaming mode.
+     * In adaptive mode, the driver runs in streaming mode and switches to reliable mode while
+     * the error rate over the last ADAPTIVE_WINDOW transfers is too high (see setAdaptiveThresholds). */
     enum CommunicationMode {
         RELIABLE_MODE,
-        STREAMING_MODE
+        STREAMING_MODE,
+        ADAPTIVE_MODE
     };
 
     TMC5160_UART_Generic(uint8_t slaveAddress = 0, // TMC5160 slave address (default 0 if NAI is low, 1 if NAI is high)
-                         uint32_t fclk = DEFAULT_F_CLK);
+                         uint32_t fclk = DEFAULT_F_CLK); // NAI is taken as high for a non zero address (see setSlaveAddress)
 
     virtual bool begin();
 
@@ -182,6 +668,15 @@ class TMC5160_UART_Generic : public TMC5160
         return writeRegister(address, data, nullptr);
     }
 
+    /* Write several registers as one burst (see TMC5160::Batch).
+     * In reliable mode the writes are verified together : they are sent back-to-back, then
+     * ADDRESS_IFCNT is read once and must have advanced by the number of writes. On a mismatch
+     * the span is split in halves, each resent and verified, down to single writes which are
+     * retried as usual. Writes made in reliable mode inside a Batch are verified the same way when
+     * the burst ends ; getVerifiedWriteStatus() then reports the outcome. */
+    uint8_t writeRegisters(const uint8_t *addresses, const uint32_t *data, uint8_t count, ReadStatus *status = nullptr);
+    ReadStatus getVerifiedWriteStatus() const { return _verifiedWriteStatus; }
+
     void resetCommunication(); // Reset communication with TMC5160 : pause activity on the serial bus.
 
     void setSlaveAddress(uint8_t slaveAddress,
@@ -197,17 +692,66 @@ class TMC5160_UART_Generic : public TMC5160
     }
 
     void setCommunicationMode(CommunicationMode mode);
+    CommunicationMode getCommunicationMode() const { return _adaptive ? ADAPTIVE_MODE : _currentMode; }
+    CommunicationMode getEffectiveCommunicationMode() const { return _currentMode; } // Never ADAPTIVE_MODE
+
+    /* Adaptive mode policy.
+     * Switch to reliable mode once escalateErrors of the last ADAPTIVE_WINDOW transfers failed
+     * (no reply, bad format or CRC, lost write), and back to streaming mode once a full window
+     * has no more than recoverErrors failures. With adaptGap, errors also lengthen the
+     * inter-frame gap (up to x4) while in reliable mode ; it is restored on recovery. */
+    static constexpr uint8_t ADAPTIVE_WINDOW = 32;
+    void setAdaptiveThresholds(uint8_t escalateErrors, uint8_t recoverErrors);
+    void setAdaptiveGap(bool adaptGap) { _adaptGap = adaptGap; }
+    float getErrorRate() const; // Over the current window
+    uint32_t getModeTransitions() const { return _modeTransitions; }
+
+    /* Bus timing.
+     * Until the baud rate is given, conservative defaults are used : 180 us between datagrams,
+     * 1 ms communication reset and reply timeout. Once it is known, these are derived from the
+     * bit time and from the SLAVECONF SENDDELAY setting. calibrateTiming() additionally measures
+     * the actual reply turnaround (a few ADDRESS_IFCNT reads) and sets the reply timeout from it.
+     * Serial must be configured at the given baud rate externally. */
+    void setBaudRate(uint32_t baudRate);
+    uint32_t getBaudRate() const { return _baudRate; }
+    void setSendDelay(uint8_t sendDelay); // SLAVECONF SENDDELAY, 0 - 15. Set >= 2 with several slaves on the bus.
+    uint8_t getSendDelay() const { return _sendDelay; }
+    bool calibrateTiming();
+    unsigned long getInterFrameGap() const { return _interFrameGap; }  // us
+    unsigned long getResetTime() const { return _resetTime; }          // us
+    unsigned long getReplyTimeout() const { return _replyTimeout; }    // us
+
+    /* Datagram CRC8 (polynomial x^8 + x^2 + x + 1, bits fed LSB first), table driven */
+    static uint8_t crc8(const uint8_t *data, uint8_t length);
 
     /* Register read / write statistics */
     void resetCommunicationSuccessRate();
     float getReadSuccessRate();
     float getWriteSuccessRate();
 
+    /* Non-blocking register access.
+     * submitRead() / submitWrite() queue a request and return immediately (false if the queue is
+     * full). poll() must then be called regularly : it sends the queued requests, collects the
+     * reply bytes, handles timeouts and calls callback(context, data, status) on completion.
+     * Reply bytes may instead be fed from an RX interrupt with onByte() ; the reply is parsed
+     * and checked as bytes arrive, and the callback is still called from poll().
+     * Requests are tried once, whatever the communication mode. Blocking accesses wait for the
+     * queue to drain first. */
+    typedef void (*AsyncCallback)(void *context, uint32_t data, ReadStatus status);
+
+    bool submitRead(uint8_t address, AsyncCallback callback, void *context = nullptr);
+    bool submitWrite(uint8_t address, uint32_t data, AsyncCallback callback = nullptr, void *context = nullptr);
+    void poll();
+    void onByte(uint8_t byte);
+    uint8_t getPendingRequests() const { return _asyncCount; }
+    bool isAsyncIdle() const { return _asyncCount == 0; }
+
   protected:
     static constexpr uint8_t NB_RETRIES_READ = 3;
     static constexpr uint8_t NB_RETRIES_WRITE = 3;
 
     uint8_t _slaveAddress;
+    bool _nai;  // NAI input high : the chip answers to SLAVECONF.slaveaddr + 1
     CommunicationMode _currentMode;
     uint8_t _transmissionCounter;
 
@@ -216,10 +760,34 @@ class TMC5160_UART_Generic : public TMC5160
     uint32_t _writeAttemptsCounter;
     uint32_t _writeSuccessfulCounter;
 
+    uint32_t _baudRate;
+    uint8_t _sendDelay;
+    unsigned long _interFrameGap;
+    unsigned long _resetTime;
+    unsigned long _replyTimeout;
+
+    void _updateTiming();
+    unsigned long _bitsToMicros(uint32_t bits) const;
+
+    /* Adaptive mode state. Outcomes are recorded as they occur ; the mode itself only changes at
+     * the start of the next blocking access (switching to reliable mode reads ADDRESS_IFCNT). */
+    bool _adaptive;
+    bool _adaptGap;
+    uint8_t _escalateErrors;
+    uint8_t _recoverErrors;
+    uint32_t _errorWindow; // 1 bit per transfer, 1 on failure, latest in bit 0
+    uint8_t _windowFill;
+    uint8_t _windowErrors;
+    uint8_t _gapShift;
+    uint32_t _modeTransitions;
+
+    void _recordOutcome(bool success);
+    void _resetErrorWindow();
+    void _adaptMode();
+
     virtual void beginTransmission()
     {
-        delayMicroseconds(180); // FIXME a communication reset time is necessary between 2 read/write accesses. Depends
-                                // on the baudrate !
+        delayMicroseconds(_interFrameGap); // Bus idle time between 2 read/write accesses
     }
 
     virtual void endTransmission()
@@ -234,14 +802,136 @@ class TMC5160_UART_Generic : public TMC5160
 
     uint32_t _readReg(uint8_t address, ReadStatus *status);
     void _writeReg(uint8_t address, uint32_t data);
+    void _sendBytes(const uint8_t *buffer, uint8_t length); // Framed by beginTransmission() / endTransmission()
+
+    /* Write datagrams queued during a batch, sent with a single uartWriteBytes() call */
+    static constexpr uint8_t BATCH_BUFFER_DATAGRAMS = 8;
+    uint8_t _batchBuffer[BATCH_BUFFER_DATAGRAMS * 8];
+    uint8_t _batchLength;
+
+    void _onBatchBegin();
+    void _onBatchEnd();
+    void _flushBatch();
+
+    bool _readRegisterChecked(uint8_t address, uint32_t *value);
+
+    /* Reliable mode writes made during a batch, verified together */
+    uint8_t _pendingAddresses[BATCH_BUFFER_DATAGRAMS];
+    uint32_t _pendingData[BATCH_BUFFER_DATAGRAMS];
+    uint8_t _pendingCount;
+    ReadStatus _verifiedWriteStatus;
+    bool _verifyingWrites;  // The bursts of _writeVerified() are internal batches
+
+    void _flushVerifiedWrites();
+    bool _writeVerified(const uint8_t *addresses, const uint32_t *data, uint8_t count, uint8_t retries);
+
+    /* Reply datagram reception, shared by blocking and non-blocking reads.
+     * _receiveByte() returns true once a complete reply has been received. */
+    uint8_t _rxBuffer[8];
+    volatile uint8_t _rxLength;
+    uint8_t _rxCrc; // Running CRC of the reply bytes received so far, bit-reflected
+
+    bool _receiveByte(uint8_t byte);
+    uint32_t _decodeReply(uint8_t address, ReadStatus *status);
+    void _sendReadRequest(uint8_t address);
 
   private:
     static constexpr uint8_t SYNC_BYTE = 0x05;
     static constexpr uint8_t MASTER_ADDRESS = 0xFF;
+    static constexpr uint8_t ASYNC_QUEUE_LENGTH = 4;
+
+    // Timing defaults when the baud rate is unknown (us)
+    static constexpr unsigned long DEFAULT_INTERFRAME_GAP = 180;
+    static constexpr unsigned long DEFAULT_RESET_TIME = 1000;
+    static constexpr unsigned long DEFAULT_REPLY_TIMEOUT = 1000;
+
+    // Bus timing in bit times (datasheet §5.2). A byte is 10 bit times with start and stop bits.
+    static constexpr uint32_t INTERFRAME_GAP_BITS = 12;   // Idle time the slave needs to recover
+    static constexpr uint32_t RESET_BITS = 63 + 12;       // Pause resetting communication, then recovery time
+    static constexpr uint32_t REQUEST_BITS = 4 * 10;      // Read request, possibly still in the TX buffer
+    static constexpr uint32_t REPLY_BITS = 8 * 10;
+    static constexpr unsigned long TIMING_SLACK = 100;    // us, for interrupt and task latencies
+    static constexpr uint8_t CALIBRATION_READS = 4;
+    static constexpr uint8_t MAX_GAP_SHIFT = 2;
+    static constexpr uint8_t DEFAULT_ESCALATE_ERRORS = 3;
+    static constexpr uint8_t DEFAULT_RECOVER_ERRORS = 0;
+
+    struct AsyncRequest {
+        uint8_t address;
+        bool write;
+        uint32_t data;
+        AsyncCallback callback;
+        void *context;
+    };
+
+    AsyncRequest _asyncQueue[ASYNC_QUEUE_LENGTH];
+    uint8_t _asyncHead;
+    uint8_t _asyncCount;
+    bool _asyncWaitingReply;
+    unsigned long _asyncStartTime;
+
+    TMC5160_UART_Bus *_bus;
+
+    bool _submit(uint8_t address, bool write, uint32_t data, AsyncCallback callback, void *context);
+    void _startNextRequest();
+    void _sendQueuedWrites();
+    void _sendHeadRead();
+    bool _pollReply();  // Returns true once the pending read has completed or timed out
+    void _completeRequest(uint32_t data, ReadStatus status);
+    void _waitAsyncIdle();
+    bool _hasQueuedWrite() const { return _asyncCount > 0 && _asyncQueue[_asyncHead].write; }
 
     void computeCrc(uint8_t *datagram, uint8_t datagramLength);
 };
 
+/* Multi-drop UART bus :
+ * several TMC5160_UART_Generic with different slave addresses sharing one serial line. Drivers
+ * attached to the bus no longer drive it on their own : only one read is on the wire at a time,
+ * the queued writes of every slave are sent back-to-back ahead of the next read (they need no
+ * reply, so they fill the bus while no reply is awaited), and reads are served round-robin.
+ * A single-wire bus cannot overlap the SENDDELAY window of one slave with another request, so
+ * set a small SENDDELAY (>= 2) and the baud rate (setBaudRate) to keep the gaps short.
+ * Blocking accesses of an attached driver wait until the bus is idle.
+ */
+class TMC5160_UART_Bus
+{
+    friend class TMC5160_UART_Generic;
+
+  public:
+    static constexpr uint8_t MAX_SLAVES = 8;
+
+    struct SlaveStatistics {
+        uint32_t reads;
+        uint32_t writes;
+        uint32_t errors;              // Reads without a valid reply
+        unsigned long lastLatency;    // us, from read request to reply
+        unsigned long maxLatency;     // us
+        uint32_t totalLatency;        // us, sum over all the reads
+    };
+
+    TMC5160_UART_Bus();
+
+    bool attach(TMC5160_UART_Generic &driver); // false if the bus is full
+    uint8_t getSlaveCount() const { return _slaveCount; }
+
+    void poll(); // Advance the queued requests of all the attached drivers
+    bool isIdle() const { return _owner == nullptr; }
+
+    const SlaveStatistics &getStatistics(uint8_t slave) const { return _statistics[slave]; }
+    float getAverageLatency(uint8_t slave) const;
+    void resetStatistics();
+
+  private:
+    TMC5160_UART_Generic *_slaves[MAX_SLAVES];
+    SlaveStatistics _statistics[MAX_SLAVES];
+    uint8_t _slaveCount;
+    uint8_t _nextSlave;           // Round-robin position for reads
+    TMC5160_UART_Generic *_owner; // Driver waiting for a reply
+
+    void _waitIdle();
+    void _record(TMC5160_UART_Generic *driver, bool write, bool success, unsigned long latency);
+};
+
 /* Arduino UART interface :
  * the TMC5160 SWSEL input must be tied high.
  *
@@ -0,0 +1,143 @@
+/* Compile-time specialized driver.
+ *
+ * For builds where the clock frequency and the microstep resolution are fixed :
+ *     TMC5160T<12000000, 256, TMC5160_SPI> motor(CS_PIN);
+ * The unit conversion factors and the register limits are constants folded into the calls,
+ * and the register accesses of the motion functions below call the transport directly instead
+ * of through the virtual readRegister() / writeRegister(). Everything else is inherited from the
+ * transport, so the object can still be used as a TMC5160.
+ *
+ * Units : positions in full steps (USTEPS microsteps), speeds in steps / second, accelerations
+ * in steps / second^2, for these functions and the inherited ones alike (and through a TMC5160 &).
+ * begin() sets the chip microstep resolution (CHOPCONF.mres) to USTEPS.
+ */
+#ifndef TMC5160T_H
+#define TMC5160T_H
+
+#include "TMC5160.h"
+
+template <uint32_t FCLK, uint16_t USTEPS = _uStepCount>
+struct TMC5160_Config
+{
+    static_assert(FCLK >= 4000000 && FCLK <= 18000000, "fclk must be 4MHz .. 18MHz");
+    static_assert(USTEPS >= 1 && USTEPS <= 256 && (USTEPS & (USTEPS - 1)) == 0,
+                  "USTEPS must be a power of two up to 256");
+
+    static constexpr uint32_t fclk = FCLK;
+    static constexpr uint16_t uSteps = USTEPS;
+
+    // Register limits
+    static constexpr uint32_t VMAX_LIMIT = 0x7FFFFF;    // 23 bits
+    static constexpr uint32_t VSTART_LIMIT = 0x3FFFF;   // VSTART, VSTOP : 18 bits
+    static constexpr uint32_t V1_LIMIT = 0xFFFFF;       // 20 bits
+    static constexpr uint32_t ACCEL_LIMIT = 0xFFFF;     // AMAX, DMAX, A1, D1 : 16 bits
+    static constexpr uint32_t TSTEP_LIMIT = 0xFFFFF;    // TPWMTHRS, TCOOLTHRS, THIGH : 20 bits
+
+    // Same conversions as TMC5160::setClockFrequency()
+    static constexpr float speedToHzScale = (float)FCLK / (float)(1ul << 24) / (float)USTEPS;
+    static constexpr float speedUnitHz = (float)FCLK / (float)(1ul << 24);
+    static constexpr double accelUnitHz = (float)FCLK * (float)FCLK / (512.0 * 256.0) / (float)(1ul << 24);
+    static constexpr uint32_t speedFactor = (uint32_t)(((1ull << 48) + FCLK / 2) / FCLK);  // Q8.24
+    static constexpr uint32_t accelFactor =                                                 // Q0.32
+        (uint32_t)(((((1ull << 62) + FCLK / 2) / FCLK << 11) + FCLK / 2) / FCLK);
+};
+
+template <uint32_t FCLK, uint16_t USTEPS, class Transport>
+class TMC5160T final : public Transport
+{
+  public:
+    typedef TMC5160_Config<FCLK, USTEPS> Config;
+
+    /* Takes the transport constructor arguments. Its fclk argument, if any, is overridden. */
+    template <typename... Args>
+    explicit TMC5160T(Args &&... args) : Transport(static_cast<Args &&>(args)...)
+    {
+        this->setClockFrequency(FCLK);
+        this->setMicrostepsPerStep(USTEPS);  // The inherited float units and CHOPCONF.mres follow USTEPS
+    }
+
+    /* Conversions to chip units, constant expressions for constant arguments */
+    static constexpr float speedToHz(int32_t speedInternal) { return (float)speedInternal * Config::speedToHzScale; }
+    static constexpr int32_t speedFromHz(float speedHz) { return (int32_t)(speedHz / Config::speedUnitHz * (float)USTEPS); }
+    static constexpr int32_t accelFromHz(float accelHz) { return (int32_t)(accelHz / Config::accelUnitHz * (float)USTEPS); }
+    static constexpr uint32_t thrsSpeedToTstep(float thrsSpeed)  // TSTEP counts 1/256 microsteps
+    {
+        return thrsSpeed <= 0.0f ? 0 : (float)FCLK / (thrsSpeed * 256.0) > (double)Config::TSTEP_LIMIT
+            ? Config::TSTEP_LIMIT : (uint32_t)((float)FCLK / (thrsSpeed * 256.0));
+    }
+    static constexpr int32_t speedFromMicrosteps(int32_t microstepsPerSecond)
+    {
+        return microstepsPerSecond < 0 ? -_saturate(_scale(-(uint32_t)microstepsPerSecond, Config::speedFactor, 24))
+                                       : _saturate(_scale((uint32_t)microstepsPerSecond, Config::speedFactor, 24));
+    }
+    static constexpr uint32_t accelFromMicrosteps(uint32_t microstepsPerSecond2)
+    {
+        return (uint32_t)_scale(microstepsPerSecond2, Config::accelFactor, 32);
+    }
+
+    /* Motion, in the units above */
+    float getCurrentPosition() { return (float)(int32_t)Transport::readRegister(ADDRESS_XACTUAL) / (float)USTEPS; }
+    float getTargetPosition() { return (float)(int32_t)Transport::readRegister(ADDRESS_XTARGET) / (float)USTEPS; }
+    void setTargetPosition(float position) { Transport::writeRegister(ADDRESS_XTARGET, (int32_t)(position * (float)USTEPS)); }
+
+    float getCurrentSpeed()
+    {
+        uint32_t data = Transport::readRegister(ADDRESS_VACTUAL);
+        return data == 0xFFFFFFFF ? NAN : speedToHz((int32_t)(data << 8) >> 8);  // 24-bit signed
+    }
+
+    void moveAtVelocity(float speed) { moveAtVelocityRaw(speedFromHz(speed)); }
+
+    void moveAtVelocityRaw(int32_t vmax)
+    {
+        typename Transport::Batch batch(*this);
+
+        uint32_t speed = vmax < 0 ? -(uint32_t)vmax : (uint32_t)vmax;
+        Transport::writeRegister(ADDRESS_VMAX, speed > Config::VMAX_LIMIT ? Config::VMAX_LIMIT : speed);
+
+        if (this->getRampMode() == VELOCITY_MODE)
+            Transport::writeRegister(ADDRESS_RAMPMODE, vmax < 0 ? VELOCITY_MODE_NEG : VELOCITY_MODE_POS);
+    }
+
+    void setRampSpeeds(float startSpeed, float stopSpeed, float transitionSpeed)
+    {
+        typename Transport::Batch batch(*this);
+
+        Transport::writeRegister(ADDRESS_VSTART, _clamp(speedFromHz(fabs(startSpeed)), Config::VSTART_LIMIT));
+        Transport::writeRegister(ADDRESS_VSTOP, _clamp(speedFromHz(fabs(stopSpeed)), Config::VSTART_LIMIT));
+        Transport::writeRegister(ADDRESS_V_1, _clamp(speedFromHz(fabs(transitionSpeed)), Config::V1_LIMIT));
+    }
+
+    void setAcceleration(float maxAccel) { setAccelerationRaw(accelFromHz(fabs(maxAccel))); }
+    void setAccelerationRaw(uint32_t amax) { Transport::writeRegister(ADDRESS_AMAX, _clamp(amax, Config::ACCEL_LIMIT)); }
+
+    void setAccelerations(float maxAccel, float startAccel, float maxDecel, float finalDecel)
+    {
+        typename Transport::Batch batch(*this);
+
+        Transport::writeRegister(ADDRESS_DMAX, _clamp(accelFromHz(fabs(maxDecel)), Config::ACCEL_LIMIT));
+        Transport::writeRegister(ADDRESS_AMAX, _clamp(accelFromHz(fabs(maxAccel)), Config::ACCEL_LIMIT));
+        Transport::writeRegister(ADDRESS_A_1, _clamp(accelFromHz(fabs(startAccel)), Config::ACCEL_LIMIT));
+        Transport::writeRegister(ADDRESS_D_1, _clamp(accelFromHz(fabs(finalDecel)), Config::ACCEL_LIMIT));
+    }
+
+    void setModeChangeSpeeds(float pwmThrs, float coolThrs, float highThrs)
+    {
+        typename Transport::Batch batch(*this);
+
+        Transport::writeRegister(ADDRESS_TPWMTHRS, thrsSpeedToTstep(pwmThrs));
+        Transport::writeRegister(ADDRESS_TCOOLTHRS, thrsSpeedToTstep(coolThrs));
+        Transport::writeRegister(ADDRESS_THIGH, thrsSpeedToTstep(highThrs));
+    }
+
+  private:
+    static constexpr uint64_t _scale(uint32_t value, uint32_t factor, uint8_t shift)
+    {
+        return ((uint64_t)value * factor + (1ull << (shift - 1))) >> shift;
+    }
+
+    static constexpr int32_t _saturate(uint64_t value) { return value > 0x7FFFFFFF ? 0x7FFFFFFF : (int32_t)value; }
+    static constexpr uint32_t _clamp(uint32_t value, uint32_t limit) { return value > limit ? limit : value; }
+};
+
+#endif // TMC5160T_H
@@ -0,0 +1,91 @@
+#include "TMC5160_Coordinator.h"
+
+TMC5160_Coordinator::TMC5160_Coordinator()
+: _axisCount(0), _chain(nullptr), _path(), _pathLength(0)
+{
+}
+
+bool TMC5160_Coordinator::addAxis(TMC5160 &driver)
+{
+    if (_axisCount >= TMC5160_COORDINATOR_AXES)
+        return false;
+
+    _axes[_axisCount++] = &driver;
+    return true;
+}
+
+bool TMC5160_Coordinator::moveTo(const int32_t *targets)
+{
+    if (_path.vmax == 0 || _path.amax == 0 || _path.dmax == 0)
+        return false;
+
+    int32_t moves[TMC5160_COORDINATOR_AXES];
+    float squared = 0;
+
+    for (uint8_t i = 0; i < _axisCount; i++) {
+        if (_axes[i]->getRampMode() != POSITIONING_MODE)
+            return false;
+
+        // Modular difference : the chip moves the shortest way around the 32-bit position
+        uint32_t position = (uint32_t)_axes[i]->getExtendedPosition();
+        moves[i] = (int32_t)((uint32_t)targets[i] - position);
+        squared += (float)moves[i] * (float)moves[i];
+    }
+
+    _pathLength = sqrt(squared);
+    if (_pathLength == 0)
+        return true;
+
+    // Ramps, scaled by each axis share of the path
+    for (uint8_t i = 0; i < _axisCount; i++) {
+        if (moves[i] == 0)
+            continue;
+
+        float ratio = fabs((float)moves[i]) / _pathLength;
+        TMC5160 &axis = *_axes[i];
+        TMC5160::Batch batch(axis);
+
+        axis.writeRegister(ADDRESS_VSTART, _scale(_path.vstart, ratio));
+        axis.writeRegister(ADDRESS_A_1, _scale(_path.a1, ratio));
+        axis.writeRegister(ADDRESS_V_1, _scale(_path.v1, ratio));
+        axis.writeRegister(ADDRESS_AMAX, _scale(_path.amax, ratio));
+        axis.writeRegister(ADDRESS_VMAX, _scale(_path.vmax, ratio));
+        axis.writeRegister(ADDRESS_DMAX, _scale(_path.dmax, ratio));
+        axis.writeRegister(ADDRESS_D_1, _scale(_path.d1, ratio));
+        axis.writeRegister(ADDRESS_VSTOP, _scale(_path.vstop, ratio));
+        axis.writeRegister(ADDRESS_TZEROWAIT, _path.tzerowait);
+    }
+
+    // Start : targets back to back, one transaction on a daisy chain
+    if (_chain != nullptr)
+        _chain->beginUpdate();
+
+    for (uint8_t i = 0; i < _axisCount; i++) {
+        if (moves[i] != 0)
+            _axes[i]->writeRegister(ADDRESS_XTARGET, targets[i]);
+    }
+
+    if (_chain != nullptr)
+        _chain->endUpdate();
+
+    return true;
+}
+
+bool TMC5160_Coordinator::isTargetReached()
+{
+    for (uint8_t i = 0; i < _axisCount; i++) {
+        if (!_axes[i]->isTargetPositionReached())
+            return false;
+    }
+    return true;
+}
+
+// Rounded, and a set parameter stays set : 0 has a meaning of its own (disabled phase)
+uint32_t TMC5160_Coordinator::_scale(uint32_t value, float ratio)
+{
+    if (value == 0)
+        return 0;
+
+    uint32_t scaled = (uint32_t)((float)value * ratio + 0.5f);
+    return scaled != 0 ? scaled : 1;
+}
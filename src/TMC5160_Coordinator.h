@@ -0,0 +1,55 @@
+/* Coordinated straight line moves of several axes, one TMC5160 each (positioning mode).
+ *
+ * The ramp parameters describe the motion along the path, in microsteps of path length
+ * (euclidean norm of the axis moves). moveTo() scales them on each axis by its share of the path,
+ * so that the velocity profiles of all the axes are proportional : they start together, stay on
+ * the straight line and arrive together, within the rounding of the scaled registers.
+ *
+ * The axes are written their ramp first, then XTARGET in a burst of back to back writes. When the
+ * axes are drivers of one SPI daisy chain (setChain()), the burst is a single transaction : the
+ * axes start on the same clock edge.
+ */
+#ifndef TMC5160_COORDINATOR_H
+#define TMC5160_COORDINATOR_H
+
+#include "TMC5160.h"
+#include "TMC5160_RampPredictor.h"
+
+#ifndef TMC5160_COORDINATOR_AXES
+#define TMC5160_COORDINATOR_AXES 4
+#endif
+
+class TMC5160_Coordinator
+{
+  public:
+    typedef TMC5160_RampPredictor::Parameters Parameters;  // Chip units
+
+    TMC5160_Coordinator();
+
+    bool addAxis(TMC5160 &driver);  // false when TMC5160_COORDINATOR_AXES axes are set
+    uint8_t getAxisCount() const { return _axisCount; }
+    void setChain(TMC5160_SPI_Chain &chain) { _chain = &chain; }  // All axes are devices of this chain
+
+    void setPathParameters(const Parameters &parameters) { _path = parameters; }
+    const Parameters &getPathParameters() const { return _path; }
+
+    /* Move every axis to its target (microsteps, in addAxis() order). Reads the axis positions,
+     * then writes the scaled ramps and the targets. Returns false if an axis is not in positioning
+     * mode or the path has no VMAX / AMAX / DMAX. */
+    bool moveTo(const int32_t *targets);
+    float getPathLength() const { return _pathLength; }  // Of the last move, microsteps
+
+    bool isTargetReached();  // All axes
+
+  private:
+    TMC5160 *_axes[TMC5160_COORDINATOR_AXES];
+    uint8_t _axisCount;
+    TMC5160_SPI_Chain *_chain;
+
+    Parameters _path;
+    float _pathLength;
+
+    static uint32_t _scale(uint32_t value, float ratio);
+};
+
+#endif // TMC5160_COORDINATOR_H
@@ -0,0 +1,213 @@
+#include "TMC5160_Events.h"
+
+TMC5160_Events *TMC5160_Events::_slotOwners[MAX_PINS];
+uint8_t TMC5160_Events::_slotLines[MAX_PINS];
+void (*const TMC5160_Events::_trampolines[MAX_PINS])() = { _trampoline<0>, _trampoline<1>, _trampoline<2>,
+                                                           _trampoline<3> };
+
+TMC5160_Events::TMC5160_Events(TMC5160 &driver)
+: _driver(driver), _activeLevel(LOW), _diag0Stall(false), _head(0), _tail(0), _overflows(0), _lastTime(0)
+{
+    for (uint8_t i = 0; i < EVENT_COUNT; i++) {
+        _callbacks[i] = nullptr;
+        _contexts[i] = nullptr;
+    }
+    _pins[0] = _pins[1] = NO_PIN;
+}
+
+TMC5160_Events::~TMC5160_Events()
+{
+    end();
+}
+
+void TMC5160_Events::setCallback(Event event, Callback callback, void *context)
+{
+    if (event >= EVENT_COUNT)
+        return;
+
+    _callbacks[event] = callback;
+    _contexts[event] = context;
+}
+
+bool TMC5160_Events::begin(uint8_t diag0Pin, uint8_t diag1Pin, bool pushPull)
+{
+    end();
+
+    uint8_t needed = (diag0Pin != NO_PIN) + (diag1Pin != NO_PIN);
+    uint8_t slots[2];
+    uint8_t found = 0;
+    for (uint8_t slot = 0; slot < MAX_PINS && found < needed; slot++) {
+        if (_slotOwners[slot] == nullptr)
+            slots[found++] = slot;
+    }
+    if (found < needed)
+        return false;
+
+    bool stall = _callbacks[STALL] != nullptr;
+    bool index = _callbacks[INDEX] != nullptr && diag1Pin != NO_PIN;
+    _diag0Stall = stall && diag1Pin == NO_PIN;
+
+    // Datasheet §5.1 GCONF : in motion controller mode (SD_MODE=0) bits 7 and 8 signal a stall
+    GCONF_Register gconf;
+    gconf.bytes = _driver.readShadowRegister(ADDRESS_GCONF);
+    gconf.diag0_error = _callbacks[DRIVER_ERROR] != nullptr;
+    gconf.diag0_stall_step = _diag0Stall;
+    gconf.diag1_stall_dir = stall && diag1Pin != NO_PIN;
+    gconf.diag1_index = index;
+    gconf.diag0_int_pushpull = pushPull;
+    gconf.diag1_poscomp_pushpull = pushPull;
+
+    {
+        TMC5160::Batch batch(_driver);
+        _driver.writeRegister(ADDRESS_GCONF, gconf.bytes);
+
+        // Stale events (event_pos_reached is set by a reset) would hold DIAG0 active
+        _driver.writeRegister(ADDRESS_RAMP_STAT, 0xF0);  // event_stop_l, event_stop_r, event_stop_sg, event_pos_reached
+        _driver.writeRegister(ADDRESS_ENC_STATUS, 0x03);
+    }
+
+    _pins[0] = diag0Pin;
+    _pins[1] = diag1Pin;
+    _activeLevel = pushPull ? HIGH : LOW;
+    _head = _tail = 0;
+
+    found = 0;
+    for (uint8_t line = 0; line < 2; line++) {
+        if (_pins[line] == NO_PIN)
+            continue;
+
+        uint8_t slot = slots[found++];
+        _slotOwners[slot] = this;
+        _slotLines[slot] = line;
+
+        pinMode(_pins[line], pushPull ? INPUT : INPUT_PULLUP);
+        attachInterrupt(digitalPinToInterrupt(_pins[line]), _trampolines[slot], pushPull ? RISING : FALLING);
+    }
+
+    return true;
+}
+
+void TMC5160_Events::end()
+{
+    for (uint8_t slot = 0; slot < MAX_PINS; slot++) {
+        if (_slotOwners[slot] != this)
+            continue;
+
+        detachInterrupt(digitalPinToInterrupt(_pins[_slotLines[slot]]));
+        _slotOwners[slot] = nullptr;
+    }
+
+    _pins[0] = _pins[1] = NO_PIN;
+}
+
+uint8_t TMC5160_Events::dispatch()
+{
+    uint8_t count = 0;
+    bool cleared = false;
+
+    while (_tail != _head) {
+        const Interrupt &interrupt = _queue[_tail];
+        _lastTime = interrupt.time;
+        uint8_t line = interrupt.line;
+        _tail = (_tail + 1) % TMC5160_EVENT_QUEUE_LENGTH;
+
+        count += line == 0 ? _dispatchDiag0(cleared) : _dispatchDiag1();
+    }
+
+    // An event raised before the previous one was cleared gave no new edge
+    if (cleared && digitalRead(_pins[0]) == _activeLevel)
+        count += _dispatchDiag0(cleared, true);
+
+    return count;
+}
+
+uint8_t TMC5160_Events::_call(Event event)
+{
+    if (_callbacks[event] == nullptr)
+        return 0;
+
+    _callbacks[event](_driver, _contexts[event]);
+    return 1;
+}
+
+uint8_t TMC5160_Events::_dispatchDiag0(bool &cleared, bool recheck)
+{
+    uint8_t count = 0;
+
+    RAMP_STAT_Register rampStat;
+    rampStat.bytes = _driver._readRegisterExact(ADDRESS_RAMP_STAT);
+    if (rampStat.bytes == 0xFFFFFFFF) // Read failure
+        return 0;
+
+    uint32_t events = rampStat.bytes & 0xF0;
+    if (events != 0) {
+        _driver.writeRegister(ADDRESS_RAMP_STAT, events); // R+WC, releases DIAG0
+        cleared = true;
+    }
+
+    if (rampStat.event_pos_reached)
+        count += _call(POSITION_REACHED);
+    // Only with the stall routed to DIAG0, else DIAG1 reports it. status_sg stays set during the
+    // stall and keeps DIAG0 active : it is not a new stall on a recheck.
+    if (_diag0Stall && (rampStat.event_stop_sg || (rampStat.status_sg && !recheck)))
+        count += _call(STALL);
+
+    // The index has its own pin when DIAG1 is used
+    bool index = _callbacks[INDEX] != nullptr && _pins[1] == NO_PIN;
+    if (index || _callbacks[DEVIATION] != nullptr) {
+        ENC_STATUS_Register encStatus;
+        encStatus.bytes = _driver._readRegisterExact(ADDRESS_ENC_STATUS);
+
+        if (encStatus.bytes != 0xFFFFFFFF && (encStatus.bytes & 0x03) != 0) {
+            _driver.writeRegister(ADDRESS_ENC_STATUS, encStatus.bytes & 0x03);
+            cleared = true;
+
+            if (index && encStatus.n_event)
+                count += _call(INDEX);
+            if (encStatus.deviation_warn)
+                count += _call(DEVIATION);
+        }
+    }
+
+    if (count == 0 && _callbacks[DRIVER_ERROR] != nullptr) {
+        GSTAT_Register gstat;
+        gstat.bytes = _driver._readRegisterExact(ADDRESS_GSTAT);
+
+        if (gstat.bytes != 0xFFFFFFFF && (gstat.drv_err || gstat.uv_cp))
+            count += _call(DRIVER_ERROR);
+    }
+
+    return count;
+}
+
+uint8_t TMC5160_Events::_dispatchDiag1()
+{
+    bool stall = _callbacks[STALL] != nullptr;
+    bool index = _callbacks[INDEX] != nullptr;
+
+    if (stall && index) {
+        RAMP_STAT_Register rampStat;
+        rampStat.bytes = _driver._readRegisterExact(ADDRESS_RAMP_STAT);
+        if (rampStat.bytes == 0xFFFFFFFF)
+            return 0;
+
+        return _call(rampStat.status_sg ? STALL : INDEX);
+    }
+
+    return stall ? _call(STALL) : _call(INDEX);
+}
+
+void TMC5160_Events::_onInterrupt(uint8_t line)
+{
+    uint8_t head = _head;
+    uint8_t next = (head + 1) % TMC5160_EVENT_QUEUE_LENGTH;
+
+    if (next == _tail) {
+        _overflows++;
+        return;
+    }
+
+    _queue[head].line = line;
+    _queue[head].time = micros();
+    _head = next;
+}
@@ -0,0 +1,100 @@
+/* Interrupt driven dispatch of the chip events signalled on the DIAG0 / DIAG1 outputs.
+ *
+ * In motion controller mode SWN_DIAG0 is the interrupt output : the RAMP_STAT events
+ * (event_pos_reached, event_stop_sg, stop switches) and the ENC_STATUS events drive it until they
+ * are cleared, plus the driver errors (diag0_error) and a stall when DIAG1 is not used.
+ * SWP_DIAG1 signals a stall and / or the encoder index. begin() sets the GCONF routing for the
+ * callbacks registered before it, and attaches the pin interrupts.
+ *
+ * The interrupt handlers only queue the pin and the time (TMC5160_EVENT_QUEUE_LENGTH entries, no
+ * bus access). dispatch(), called from loop(), then reads the registers of the pin that fired :
+ * RAMP_STAT for DIAG0 (ENC_STATUS if an encoder callback is set, GSTAT for a driver error), none
+ * for DIAG1 unless it carries both stall and index. It clears the events and calls the callbacks.
+ * Nothing is read while no interrupt fires.
+ *
+ * Stall detection needs TCOOLTHRS and the stallGuard settings, see the StallGuardTest example.
+ */
+#ifndef TMC5160_EVENTS_H
+#define TMC5160_EVENTS_H
+
+#include "TMC5160.h"
+
+#ifndef TMC5160_EVENT_QUEUE_LENGTH
+#define TMC5160_EVENT_QUEUE_LENGTH 8
+#endif
+
+class TMC5160_Events
+{
+  public:
+    static constexpr uint8_t NO_PIN = 0xFF;
+    static constexpr uint8_t MAX_PINS = 4;  // Interrupt pins used by all the instances
+
+    enum Event : uint8_t {
+        POSITION_REACHED,
+        STALL,
+        DRIVER_ERROR,  // GSTAT drv_err or uv_cp : call getDriverStatus() for the details
+        INDEX,
+        DEVIATION,     // Encoder deviation (setEncoderAllowedDeviation())
+        EVENT_COUNT
+    };
+
+    typedef void (*Callback)(TMC5160 &driver, void *context);
+
+    explicit TMC5160_Events(TMC5160 &driver);
+    ~TMC5160_Events();
+
+    void onPositionReached(Callback callback, void *context = nullptr) { setCallback(POSITION_REACHED, callback, context); }
+    void onStall(Callback callback, void *context = nullptr) { setCallback(STALL, callback, context); }
+    void onDriverError(Callback callback, void *context = nullptr) { setCallback(DRIVER_ERROR, callback, context); }
+    void onIndex(Callback callback, void *context = nullptr) { setCallback(INDEX, callback, context); }
+    void onDeviation(Callback callback, void *context = nullptr) { setCallback(DEVIATION, callback, context); }
+    void setCallback(Event event, Callback callback, void *context = nullptr);
+
+    /* Route the events to the DIAG outputs and attach the interrupts. pushPull selects push-pull
+     * outputs, active high ; otherwise open drain, active low, with the pin pull-up enabled.
+     * Returns false without MAX_PINS free interrupt slots. */
+    bool begin(uint8_t diag0Pin, uint8_t diag1Pin = NO_PIN, bool pushPull = false);
+    void end();
+
+    uint8_t dispatch();  // Handle the queued interrupts, returns the number of callbacks called
+    bool isPending() const { return _head != _tail; }
+    uint8_t getOverflowCount() const { return _overflows; }            // Interrupts lost, queue full
+    unsigned long getLastInterruptTime() const { return _lastTime; }  // micros() of the last dispatched interrupt
+
+  private:
+    struct Interrupt
+    {
+        uint8_t line;  // 0 : DIAG0, 1 : DIAG1
+        unsigned long time;
+    };
+
+    TMC5160 &_driver;
+    Callback _callbacks[EVENT_COUNT];
+    void *_contexts[EVENT_COUNT];
+
+    uint8_t _pins[2];
+    uint8_t _activeLevel;
+    bool _diag0Stall;  // Stall on DIAG0 : no DIAG1 pin
+
+    // Single producer (interrupt handlers), single consumer (dispatch())
+    Interrupt _queue[TMC5160_EVENT_QUEUE_LENGTH];
+    volatile uint8_t _head;
+    volatile uint8_t _tail;
+    volatile uint8_t _overflows;
+    unsigned long _lastTime;
+
+    uint8_t _call(Event event);
+    uint8_t _dispatchDiag0(bool &cleared, bool recheck = false);  // recheck : no edge, DIAG0 still active
+    uint8_t _dispatchDiag1();
+    void _onInterrupt(uint8_t line);
+
+    /* attachInterrupt() handlers take no argument : one trampoline per slot */
+    static TMC5160_Events *_slotOwners[MAX_PINS];
+    static uint8_t _slotLines[MAX_PINS];
+    static void (*const _trampolines[MAX_PINS])();
+
+    template <uint8_t SLOT>
+    static void _trampoline() { _slotOwners[SLOT]->_onInterrupt(_slotLines[SLOT]); }
+};
+
+#endif // TMC5160_EVENTS_H
@@ -0,0 +1,125 @@
+#include "TMC5160_MoveQueue.h"
+
+TMC5160_MoveQueue::TMC5160_MoveQueue(TMC5160 &driver)
+: _driver(driver), _head(0), _count(0), _active(false), _target(0)
+{
+}
+
+bool TMC5160_MoveQueue::add(int32_t target, uint32_t vmax, uint32_t amax, uint32_t dmax, bool blend)
+{
+    if (_count >= TMC5160_MOVE_QUEUE_LENGTH)
+        return false;
+
+    Move &move = _moves[(_head + _count) % TMC5160_MOVE_QUEUE_LENGTH];
+    move.target = target;
+    move.vmax = min((uint32_t)0x7FFFFF, vmax); // 23 bits
+    move.amax = min((uint32_t)0xFFFF, amax);   // 16 bits
+    move.dmax = min((uint32_t)0xFFFF, dmax);
+    move.blend = blend;
+    _count++;
+    return true;
+}
+
+bool TMC5160_MoveQueue::service()
+{
+    if (_driver.getRampMode() != POSITIONING_MODE || (!_active && _count == 0))
+        return false;
+
+    if (!_active) {
+        _start();
+        return true;
+    }
+
+    uint32_t data;
+    if (!_driver._readRegisterChecked(ADDRESS_RAMP_STAT, &data))
+        return false;
+
+    RAMP_STAT_Register rampStat;
+    rampStat.bytes = data;
+    if (rampStat.position_reached) {
+        _active = false;
+        if (_count == 0)
+            return false;
+
+        _start();
+        return true;
+    }
+
+    if (_count == 0 || !_moves[_head].blend)
+        return false;
+
+    // Blend : start once the ramp brakes towards the current target, if the next one lies beyond it
+    uint32_t position;
+    if (!_driver._readRegisterChecked(ADDRESS_VACTUAL, &data) || !_driver._readRegisterChecked(ADDRESS_XACTUAL, &position))
+        return false;
+
+    int32_t velocity = (int32_t)(data << 8) >> 8; // 24-bit signed
+    int32_t beyond = (int32_t)((uint32_t)_moves[_head].target - (uint32_t)_target);
+    if (velocity == 0 || (beyond < 0) != (velocity < 0) || !_isBrakingToTarget(velocity, (int32_t)position))
+        return false;
+
+    _start();
+    return true;
+}
+
+void TMC5160_MoveQueue::clear()
+{
+    _count = 0;
+}
+
+bool TMC5160_MoveQueue::_isBrakingToTarget(int32_t velocity, int32_t position)
+{
+    int32_t remaining = (int32_t)((uint32_t)_target - (uint32_t)position);
+    if ((remaining < 0) != (velocity < 0))
+        return false;  // Past the target, coming back
+
+    // Distance to slow down to VSTOP like the ramp generator : v^2 / 2d per phase, in chip units
+    // d[microsteps] = v[5160A]^2 / (256 * a[5160A]) (the fclk terms cancel out)
+    double v = velocity < 0 ? -(double)velocity : (double)velocity;
+    uint32_t vStopRegister = _driver.readShadowRegister(ADDRESS_VSTOP);
+    double vStop = vStopRegister != 0 ? vStopRegister : 1;
+    double v1 = _driver.readShadowRegister(ADDRESS_V_1);
+    double dMax = _driver.readShadowRegister(ADDRESS_DMAX);
+    double d1 = _driver.readShadowRegister(ADDRESS_D_1);
+
+    double distance = 0;
+    if (v1 != 0 && v > v1 && v1 > vStop) {
+        if (dMax > 0)
+            distance += (v * v - v1 * v1) / (256 * dMax);
+        v = v1;
+    }
+    double d = v1 == 0 || v > v1 ? dMax : d1;
+    if (d > 0 && v > vStop)
+        distance += (v * v - vStop * vStop) / (256 * d);
+
+    // The ramp generator starts braking when the distance left reaches the braking distance ;
+    // the margin covers the deceleration since the last service call
+    double left = remaining < 0 ? -(double)remaining : (double)remaining;
+    return left <= distance * 1.125 + 1;
+}
+
+void TMC5160_MoveQueue::_start()
+{
+    const Move &move = _moves[_head];
+    _head = (_head + 1) % TMC5160_MOVE_QUEUE_LENGTH;
+    _count--;
+
+    TMC5160::Batch batch(_driver);
+
+    if (move.vmax != 0)
+        _writeIfChanged(ADDRESS_VMAX, move.vmax);
+    if (move.amax != 0)
+        _writeIfChanged(ADDRESS_AMAX, move.amax);
+    if (move.dmax != 0)
+        _writeIfChanged(ADDRESS_DMAX, move.dmax);
+    _driver.writeRegister(ADDRESS_XTARGET, move.target);
+
+    _active = true;
+    _target = move.target;
+}
+
+void TMC5160_MoveQueue::_writeIfChanged(uint8_t address, uint32_t data)
+{
+    if (!_driver.isShadowValid(address) || _driver.getShadowRegister(address) != data)
+        _driver.writeRegister(address, data);
+}
@@ -0,0 +1,58 @@
+/* Queue of positioning moves for one TMC5160, TMC5160_MOVE_QUEUE_LENGTH entries.
+ *
+ * service() starts the next move once the current one has reached its target, without waiting
+ * for the application : call it from loop(), and when a DIAG pin reports position_reached.
+ *
+ * A move queued with blend starts as soon as the ramp brakes towards the previous target, if it
+ * continues in the same direction : the motor passes the previous target without stopping. The
+ * braking is detected from the distance left to the target against the braking distance at the
+ * current speed (DMAX, D1, V1, VSTOP from the driver shadow registers), so slowing down to a lower
+ * VMAX does not start the next move early. A reversal always waits for the target.
+ *
+ * VMAX / AMAX / DMAX overrides (chip units, see TMC5160::speedFromMicrosteps()) are only written
+ * when they differ from the shadow. Each service() call reads RAMP_STAT, plus VACTUAL and XACTUAL
+ * while a blended move waits.
+ */
+#ifndef TMC5160_MOVE_QUEUE_H
+#define TMC5160_MOVE_QUEUE_H
+
+#include "TMC5160.h"
+
+#ifndef TMC5160_MOVE_QUEUE_LENGTH
+#define TMC5160_MOVE_QUEUE_LENGTH 4
+#endif
+
+class TMC5160_MoveQueue
+{
+  public:
+    explicit TMC5160_MoveQueue(TMC5160 &driver);
+
+    bool add(int32_t target, uint32_t vmax = 0, uint32_t amax = 0, uint32_t dmax = 0, bool blend = false);
+    bool service();  // Returns true if a move was started
+    void clear();    // Drop the queued moves, the current one goes on
+    uint8_t getCount() const { return _count; }
+    bool isRunning() const { return _active || _count != 0; }  // As of the last service call
+
+  private:
+    struct Move
+    {
+        int32_t target;  // XTARGET (microsteps)
+        uint32_t vmax;   // Chip units, 0 : unchanged
+        uint32_t amax;
+        uint32_t dmax;
+        bool blend;      // May start while the previous move decelerates
+    };
+
+    TMC5160 &_driver;
+    Move _moves[TMC5160_MOVE_QUEUE_LENGTH];
+    uint8_t _head;  // Next move
+    uint8_t _count;
+    bool _active;   // Started, target not reached yet
+    int32_t _target;
+
+    bool _isBrakingToTarget(int32_t velocity, int32_t position);
+    void _start();
+    void _writeIfChanged(uint8_t address, uint32_t data);
+};
+
+#endif // TMC5160_MOVE_QUEUE_H
@@ -0,0 +1,238 @@
+#include "TMC5160_RampPredictor.h"
+
+TMC5160_RampPredictor::TMC5160_RampPredictor()
+: _origin(0), _target(0), _direction(1), _startTime(0), _duration(0), _planned(false), _segmentCount(0), _end(0),
+  _distance(0)
+{
+    Parameters parameters = {};
+    setParameters(parameters);
+}
+
+void TMC5160_RampPredictor::setParameters(const Parameters &parameters, uint32_t fclk)
+{
+    _parameters = parameters;
+
+    // v[microsteps/s] = v[5160A] * fclk / 2^24, a[microsteps/s^2] = a[5160A] * fclk^2 / 2^41
+    _velocityScale = (double)fclk / (double)(1ul << 24);
+    _accelerationScale = (double)fclk * (double)fclk / (double)(1ull << 41);
+    _zeroWait = (unsigned long)((float)parameters.tzerowait * 512.0f / (float)fclk * 1e6f + 0.5f);
+
+    _vMax = parameters.vmax * _velocityScale;
+    _vStart = min(parameters.vstart, parameters.vmax) * _velocityScale;
+    _v1 = parameters.v1 * _velocityScale;
+    _vStop = parameters.vstop * _velocityScale;
+    _a1 = parameters.a1 * _accelerationScale;
+    _aMax = parameters.amax * _accelerationScale;
+    _dMax = parameters.dmax * _accelerationScale;
+    _d1 = parameters.d1 * _accelerationScale;
+}
+
+bool TMC5160_RampPredictor::loadParameters(TMC5160 &driver)
+{
+    if (!driver.isShadowValid(ADDRESS_VMAX) || !driver.isShadowValid(ADDRESS_AMAX) || !driver.isShadowValid(ADDRESS_DMAX))
+        return false;
+
+    // Registers never written hold their reset value, 0
+    Parameters parameters;
+    parameters.vstart = driver.getShadowRegister(ADDRESS_VSTART) & 0x3FFFF;  // 18 bits
+    parameters.a1 = driver.getShadowRegister(ADDRESS_A_1) & 0xFFFF;          // 16 bits
+    parameters.v1 = driver.getShadowRegister(ADDRESS_V_1) & 0xFFFFF;         // 20 bits
+    parameters.amax = driver.getShadowRegister(ADDRESS_AMAX) & 0xFFFF;
+    parameters.vmax = driver.getShadowRegister(ADDRESS_VMAX) & 0x7FFFFF;     // 23 bits
+    parameters.dmax = driver.getShadowRegister(ADDRESS_DMAX) & 0xFFFF;
+    parameters.d1 = driver.getShadowRegister(ADDRESS_D_1) & 0xFFFF;
+    parameters.vstop = driver.getShadowRegister(ADDRESS_VSTOP) & 0x3FFFF;
+    parameters.tzerowait = driver.getShadowRegister(ADDRESS_TZEROWAIT) & 0xFFFF;
+
+    setParameters(parameters, driver.getClockFrequency());
+    return true;
+}
+
+bool TMC5160_RampPredictor::plan(int32_t position, int32_t target, unsigned long startTime)
+{
+    if (_planned) {
+        unsigned long readyTime = _startTime + _duration + _zeroWait;
+        if ((long)(startTime - readyTime) < 0)
+            startTime = readyTime;
+    }
+
+    _origin = position;
+    _target = target;
+    _startTime = startTime;
+    _segmentCount = 0;
+    _end = 0;
+    _distance = 0;
+
+    if (_parameters.vmax == 0 || _parameters.amax == 0 || _parameters.dmax == 0 ||
+        (_parameters.v1 != 0 && (_parameters.a1 == 0 || _parameters.d1 == 0))) {
+        _planned = false;
+        return false;
+    }
+
+    // The chip moves the shortest way around the 32-bit position
+    int32_t difference = (int32_t)((uint32_t)target - (uint32_t)position);
+    _direction = difference < 0 ? -1 : 1;
+    double distance = fabs((double)difference);
+    double peak = _peakVelocity(distance);
+
+    // VSTART, A1 up to V1, AMAX up to the peak
+    double from = _vStart;
+    if (_v1 != 0 && from < _v1) {
+        double to = min(_v1, peak);
+        _addSegment(distance, from, _a1, (to - from) / _a1);
+        from = _v1;
+    }
+    if (peak > from)
+        _addSegment(distance, from, _aMax, (peak - from) / _aMax);
+
+    // Cruise until the braking point
+    double braking = peak > _vStop ? _rampDistance(_vStop, peak, _d1, _dMax) : 0;
+    if (peak > 0 && distance - _distance > braking)
+        _addSegment(distance, peak, 0, (distance - _distance - braking) / peak);
+
+    // DMAX down to V1, D1 down to VSTOP. The segments end on the target, then the motor stops.
+    from = peak;
+    if (_v1 > _vStop && from > _v1) {
+        _addSegment(distance, from, -_dMax, (from - _v1) / _dMax);
+        from = _v1;
+    }
+    if (from > _vStop)
+        _addSegment(distance, from, _v1 > _vStop ? -_d1 : -_dMax, (from - _vStop) / (_v1 > _vStop ? _d1 : _dMax));
+
+    _duration = (unsigned long)(_end * 1e6 + 0.5);
+    _planned = true;
+    return true;
+}
+
+int32_t TMC5160_RampPredictor::getPosition(unsigned long time) const
+{
+    double elapsed = _elapsed(time);
+    if (!_planned || elapsed >= _end)
+        return _target;
+    if (elapsed <= 0)
+        return _origin;
+
+    const Segment *segment = _segmentAt(elapsed);
+    double t = elapsed - segment->start;
+    double position = segment->position + segment->velocity * t + segment->acceleration * t * t / 2;
+
+    return (int32_t)((uint32_t)_origin + (uint32_t)(_direction * (int32_t)position));  // XACTUAL floors
+}
+
+int32_t TMC5160_RampPredictor::getVelocity(unsigned long time) const
+{
+    double elapsed = _elapsed(time);
+    if (!_planned || elapsed <= 0 || elapsed >= _end)
+        return 0;
+
+    const Segment *segment = _segmentAt(elapsed);
+    double velocity = segment->velocity + segment->acceleration * (elapsed - segment->start);
+
+    return _direction * (int32_t)(velocity / _velocityScale);  // VACTUAL truncates
+}
+
+unsigned long TMC5160_RampPredictor::getTimeToTarget(unsigned long time) const
+{
+    long remaining = (long)(getArrivalTime() - time);
+    return _planned && remaining > 0 ? remaining : 0;
+}
+
+bool TMC5160_RampPredictor::isReady(unsigned long time) const
+{
+    return !_planned || (long)(time - (getArrivalTime() + _zeroWait)) >= 0;
+}
+
+// Distance to change the speed between from and to (from <= to), with lowAcceleration below V1
+double TMC5160_RampPredictor::_rampDistance(double from, double to, double lowAcceleration, double highAcceleration) const
+{
+    if (to <= from)
+        return 0;
+
+    double split = _v1 == 0 ? from : constrain(_v1, from, to);
+    return (split * split - from * from) / (2 * lowAcceleration) + (to * to - split * split) / (2 * highAcceleration);
+}
+
+double TMC5160_RampPredictor::_moveDistance(double peak) const
+{
+    double distance = _rampDistance(_vStart, peak, _a1, _aMax);
+    if (peak > _vStop)
+        distance += _rampDistance(_vStop, peak, _d1, _dMax);
+    return distance;
+}
+
+// Highest speed of a move : VMAX, or the speed where the acceleration meets the braking
+double TMC5160_RampPredictor::_peakVelocity(double distance) const
+{
+    if (_moveDistance(_vMax) <= distance)
+        return _vMax;
+    if (_moveDistance(_vStart) >= distance)
+        return _vStart;  // Brakes from the start
+
+    // Between these speeds the distance is linear in speed^2 : interpolate exactly
+    double breaks[3] = { _vMax, _vMax, _vMax };
+    if (_v1 > _vStart && _v1 < _vMax)
+        breaks[0] = _v1;
+    if (_vStop > _vStart && _vStop < _vMax)
+        breaks[1] = _vStop;
+    if (breaks[1] < breaks[0]) {
+        double swap = breaks[0];
+        breaks[0] = breaks[1];
+        breaks[1] = swap;
+    }
+
+    double low = _vStart;
+    for (uint8_t i = 0; i < 3; i++) {
+        double high = breaks[i];
+        double lowDistance = _moveDistance(low);
+        double highDistance = _moveDistance(high);
+
+        if (high > low && highDistance >= distance) {
+            double squared = low * low + (distance - lowDistance) * (high * high - low * low) / (highDistance - lowDistance);
+            return sqrt(squared);
+        }
+
+        low = max(low, high);
+    }
+
+    return _vMax;
+}
+
+// Append a constant acceleration phase, cut where it reaches the end of the move
+void TMC5160_RampPredictor::_addSegment(double distance, double velocity, double acceleration, double duration)
+{
+    if (duration <= 0 || _distance >= distance || _segmentCount >= MAX_SEGMENTS)
+        return;
+
+    double length = velocity * duration + acceleration * duration * duration / 2;
+    if (_distance + length > distance) {
+        length = distance - _distance;
+        if (acceleration == 0) {
+            duration = length / velocity;
+        } else {
+            double discriminant = (double)velocity * velocity + 2 * acceleration * length;
+            duration = (sqrt(discriminant > 0 ? discriminant : 0) - velocity) / acceleration;
+        }
+    }
+
+    Segment &segment = _segments[_segmentCount++];
+    segment.start = _end;
+    segment.position = _distance;
+    segment.velocity = velocity;
+    segment.acceleration = acceleration;
+
+    _end += duration;
+    _distance += length;
+}
+
+const TMC5160_RampPredictor::Segment *TMC5160_RampPredictor::_segmentAt(double time) const
+{
+    uint8_t index = 0;
+    while (index + 1 < _segmentCount && _segments[index + 1].start <= time)
+        index++;
+    return &_segments[index];
+}
+
+double TMC5160_RampPredictor::_elapsed(unsigned long time) const
+{
+    return (double)(long)(time - _startTime) * 1e-6;
+}
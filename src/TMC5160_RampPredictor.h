@@ -0,0 +1,108 @@
+/* Host side model of the TMC5160 ramp generator in positioning mode.
+ *
+ * From the ramp parameters and the move (start position, XTARGET), computes the trajectory of the
+ * six point ramp : jump to VSTART, A1 up to V1, AMAX up to VMAX, cruise, DMAX down to V1, D1 down
+ * to VSTOP, stop on the target, then TZEROWAIT before the next move may start. The expected
+ * position and velocity at any time and the arrival time follow, so a sketch can sleep until the
+ * move is done and confirm it with a single read instead of polling RAMP_STAT :
+ *
+ *     motor.setTargetPosition(target);
+ *     predictor.loadParameters(motor);
+ *     predictor.plan(position, target * 256);
+ *     ... do something else for predictor.getTimeToTarget() us ...
+ *     motor.isTargetPositionReached();
+ *
+ * The model is continuous : it agrees with the chip within a few microsteps and the sub
+ * millisecond ramp quantization. Moves start from standstill (or from the end of the previous
+ * planned move). Positions in microsteps, velocities and accelerations in chip units.
+ */
+#ifndef TMC5160_RAMP_PREDICTOR_H
+#define TMC5160_RAMP_PREDICTOR_H
+
+#include "TMC5160.h"
+
+class TMC5160_RampPredictor
+{
+  public:
+    struct Parameters
+    {
+        uint32_t vstart;
+        uint32_t a1;
+        uint32_t v1;
+        uint32_t amax;
+        uint32_t vmax;
+        uint32_t dmax;
+        uint32_t d1;
+        uint32_t vstop;
+        uint32_t tzerowait;
+    };
+
+    TMC5160_RampPredictor();
+
+    void setParameters(const Parameters &parameters, uint32_t fclk = DEFAULT_F_CLK);
+    /* Ramp parameters last written to the driver (shadow registers), false if one was never written */
+    bool loadParameters(TMC5160 &driver);
+    const Parameters &getParameters() const { return _parameters; }
+
+    /* Plan the move from position to target, started at startTime (micros()). A move planned
+     * before the TZEROWAIT of the previous one has elapsed starts when it does. Returns false if
+     * the parameters never reach the target (VMAX, AMAX or DMAX zero, A1 or D1 zero with V1 set). */
+    bool plan(int32_t position, int32_t target, unsigned long startTime);
+    bool plan(int32_t position, int32_t target) { return plan(position, target, micros()); }
+
+    int32_t getPosition(unsigned long time) const;  // Expected XACTUAL
+    int32_t getVelocity(unsigned long time) const;  // Expected VACTUAL, signed
+    int32_t getTarget() const { return _target; }
+
+    unsigned long getStartTime() const { return _startTime; }
+    unsigned long getArrivalTime() const { return _startTime + _duration; }  // position_reached
+    unsigned long getDuration() const { return _duration; }                  // us from the start to the target
+    unsigned long getTimeToTarget(unsigned long time) const;                 // us, 0 once arrived
+    unsigned long getTimeToTarget() const { return getTimeToTarget(micros()); }
+    bool isArrived(unsigned long time) const { return getTimeToTarget(time) == 0; }
+    bool isReady(unsigned long time) const;  // TZEROWAIT elapsed : a new move starts immediately
+
+  private:
+    static constexpr uint8_t MAX_SEGMENTS = 5;
+
+    /* Constant acceleration phase, in microsteps and seconds from the start */
+    struct Segment
+    {
+        double start;
+        double position;
+        double velocity;
+        double acceleration;
+    };
+
+    Parameters _parameters;
+    // Computed in double : a float is only exact up to 2^24 microsteps and drifts over long
+    // cruises, while moves reach 2^31 (on AVR, double is float)
+    double _velocityScale;      // microsteps / s per chip unit
+    double _accelerationScale;  // microsteps / s^2 per chip unit
+    unsigned long _zeroWait;   // us
+
+    int32_t _origin;
+    int32_t _target;
+    int8_t _direction;
+    unsigned long _startTime;
+    unsigned long _duration;
+    bool _planned;
+
+    // Speeds (microsteps / s) and accelerations (microsteps / s^2) of the ramp, V1 0 if disabled
+    double _vStart, _v1, _vMax, _vStop;
+    double _a1, _aMax, _dMax, _d1;
+
+    Segment _segments[MAX_SEGMENTS];
+    uint8_t _segmentCount;
+    double _end;       // s from the start to the target
+    double _distance;  // Covered by the segments so far
+
+    double _rampDistance(double from, double to, double lowAcceleration, double highAcceleration) const;
+    double _moveDistance(double peak) const;  // Accelerating to peak, then braking to VSTOP
+    double _peakVelocity(double distance) const;
+    void _addSegment(double distance, double velocity, double acceleration, double duration);
+    const Segment *_segmentAt(double time) const;
+    double _elapsed(unsigned long time) const;
+};
+
+#endif // TMC5160_RAMP_PREDICTOR_H
@@ -2,7 +2,7 @@
 
 #ifndef TMC5160_REGISTERS_H
 #define TMC5160_REGISTERS_H
-#include "arduino.h"
+#include <Arduino.h>
 
 #pragma once
 #pragma pack(push, 1)
@@ -81,6 +81,19 @@ const static uint8_t ADDRESS_PWM_SCALE = 0x71;  ///< Results of stealthChop ampl
 const static uint8_t ADDRESS_PWM_AUTO = 0x72;   ///< Automatically determined PWM config values
 const static uint8_t ADDRESS_LOST_STEPS = 0x73; ///< Number of input steps skipped due to dcStep. only with SD_MODE = 1
 
+// Register access flags, following the register map of the datasheet (R, W, RW, R+WC)
+static constexpr uint8_t REG_READ     = 0x01; ///< Register can be read
+static constexpr uint8_t REG_WRITE    = 0x02; ///< Register can be written
+static constexpr uint8_t REG_CLEAR    = 0x04; ///< Flags are cleared by writing 1 (R+WC)
+static constexpr uint8_t REG_VOLATILE = 0x08; ///< Read value is updated by the chip, or differs from the written one
+
+static constexpr uint8_t REG_ACCESS_R   = REG_READ;
+static constexpr uint8_t REG_ACCESS_W   = REG_WRITE;
+static constexpr uint8_t REG_ACCESS_RW  = REG_READ | REG_WRITE;
+static constexpr uint8_t REG_ACCESS_RWC = REG_READ | REG_WRITE | REG_CLEAR;
+
+static constexpr uint8_t REGISTER_ADDRESS_COUNT = 0x74; ///< Addresses 0x00 to ADDRESS_LOST_STEPS
+
 // General Configuration Registers
 union GCONF_Register {
     struct {
@@ -118,6 +131,21 @@ union GSTAT_Register {
     uint32_t bytes;
 };
 
+// SPI Status Byte, returned as the first byte of every SPI datagram
+union SPI_STATUS_Register {
+    struct {
+        uint8_t reset_flag       : 1;  ///< ADDRESS_GSTAT[0] : IC reset since last ADDRESS_GSTAT read
+        uint8_t driver_error     : 1;  ///< ADDRESS_GSTAT[1] : driver shut down due to overtemperature or short circuit
+        uint8_t sg2              : 1;  ///< ADDRESS_DRV_STATUS[24] : stallGuard2 status
+        uint8_t standstill       : 1;  ///< ADDRESS_DRV_STATUS[31] : standstill indicator
+        uint8_t velocity_reached : 1;  ///< ADDRESS_RAMP_STAT[8] : target velocity reached
+        uint8_t position_reached : 1;  ///< ADDRESS_RAMP_STAT[9] : target position reached
+        uint8_t status_stop_l    : 1;  ///< ADDRESS_RAMP_STAT[0] : reference switch left status
+        uint8_t status_stop_r    : 1;  ///< ADDRESS_RAMP_STAT[1] : reference switch right status
+    };
+    uint8_t bytes;
+};
+
 // UART Slave Configuration
 union SLAVECONF_Register {
     struct {